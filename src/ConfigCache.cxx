@@ -0,0 +1,111 @@
+#include <cstdlib>
+#include <iostream>
+
+#include <sys/stat.h>
+
+#include "ConfigCache.h"
+
+ConfigCache::ConfigCache(std::string path) {
+  if (sqlite3_open(path.c_str(), &db)) {
+    std::cerr << "ConfigCache: unable to open " << path << std::endl;
+    sqlite3_close(db);
+    db = nullptr;
+    return;
+  }
+
+  char *sqlerr;
+  int res = sqlite3_exec(db,
+                         "CREATE TABLE IF NOT EXISTS configs (fingerprint "
+                         "TEXT PRIMARY KEY, time INTEGER, config BLOB);",
+                         NULL, 0, &sqlerr);
+  if (res) {
+    std::cerr << "ConfigCache: unable to create table: " << sqlerr
+              << std::endl;
+    sqlite3_free(sqlerr);
+  }
+}
+
+ConfigCache::~ConfigCache() {
+  if (db != nullptr) {
+    sqlite3_close(db);
+  }
+}
+
+std::string ConfigCache::default_path() {
+  std::string dir;
+  if (auto xdg = getenv("XDG_CACHE_HOME")) {
+    dir = xdg;
+  } else if (auto home = getenv("HOME")) {
+    dir = std::string{home} + "/.cache";
+    mkdir(dir.c_str(), 0755);
+  } else {
+    dir = ".";
+  }
+  dir += "/viaems";
+  mkdir(dir.c_str(), 0755);
+  return dir + "/configs.db";
+}
+
+std::optional<viaems::Configuration>
+ConfigCache::Load(const std::string &fingerprint) {
+  if (db == nullptr) {
+    return {};
+  }
+
+  std::string query =
+      "SELECT time, config FROM configs WHERE fingerprint = ?;";
+  sqlite3_stmt *stmt;
+  sqlite3_prepare_v2(db, query.c_str(), query.size(), &stmt, NULL);
+  sqlite3_bind_text(stmt, 1, fingerprint.c_str(), fingerprint.size(),
+                    SQLITE_STATIC);
+
+  std::optional<viaems::Configuration> result;
+  if (sqlite3_step(stmt) == SQLITE_ROW) {
+    auto ns = std::chrono::nanoseconds{sqlite3_column_int64(stmt, 0)};
+    auto blob = (const uint8_t *)sqlite3_column_blob(stmt, 1);
+    auto size = sqlite3_column_bytes(stmt, 1);
+
+    auto j = json::from_cbor(blob, blob + size, true, false);
+    if (!j.is_discarded()) {
+      viaems::Configuration conf{
+          .save_time = std::chrono::system_clock::time_point{ns},
+          .name = "cached",
+      };
+      try {
+        conf.from_json(j);
+        result = conf;
+      } catch (json::exception &e) {
+        std::cerr << "ConfigCache: invalid entry: " << e.what() << std::endl;
+      }
+    }
+  }
+  sqlite3_finalize(stmt);
+  return result;
+}
+
+void ConfigCache::Store(const viaems::Configuration &conf) {
+  if (db == nullptr) {
+    return;
+  }
+
+  std::string query = "INSERT OR REPLACE INTO configs VALUES(?, ?, ?);";
+  sqlite3_stmt *stmt;
+  sqlite3_prepare_v2(db, query.c_str(), query.size(), &stmt, NULL);
+
+  auto fingerprint = conf.fingerprint();
+  uint64_t time_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                         conf.save_time.time_since_epoch())
+                         .count();
+  auto blob = json::to_cbor(conf.to_json());
+
+  sqlite3_bind_text(stmt, 1, fingerprint.c_str(), fingerprint.size(),
+                    SQLITE_STATIC);
+  sqlite3_bind_int64(stmt, 2, time_ns);
+  sqlite3_bind_blob(stmt, 3, blob.data(), blob.size(), SQLITE_STATIC);
+
+  if (sqlite3_step(stmt) != SQLITE_DONE) {
+    std::cerr << "ConfigCache: unable to store config: " << sqlite3_errmsg(db)
+              << std::endl;
+  }
+  sqlite3_finalize(stmt);
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <optional>
+#include <string>
+
+#include <sqlite3.h>
+
+#include "viaems.h"
+
+/* Last known configuration for each firmware build seen, keyed by
+ * Configuration::fingerprint(), so that reconnecting to a known target can
+ * show its configuration before it has been read back */
+class ConfigCache {
+  sqlite3 *db;
+
+public:
+  ConfigCache(std::string path);
+  ConfigCache(const ConfigCache &) = delete;
+  ConfigCache &operator=(const ConfigCache &) = delete;
+  ~ConfigCache();
+
+  /* $XDG_CACHE_HOME/viaems/configs.db, or under ~/.cache */
+  static std::string default_path();
+
+  std::optional<viaems::Configuration> Load(const std::string &fingerprint);
+  void Store(const viaems::Configuration &conf);
+};
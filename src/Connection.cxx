@@ -0,0 +1,159 @@
+#include <algorithm>
+#include <iostream>
+
+#include <fcntl.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+
+#include "Connection.h"
+
+void ThreadedJsonInterface::record_inbound() {
+  if (capture) {
+    capture->Record(WireDirection::Inbound, capture_buf->consumed_data(),
+                    capture_buf->consumed_size());
+    capture_buf->discard_consumed();
+  }
+}
+
+void ThreadedJsonInterface::do_reader_thread(ThreadedJsonInterface *self) {
+  /* When capturing, read through a stream that keeps the raw bytes of each
+   * frame around long enough to record them */
+  auto &in = self->capture ? *self->capture_reader : *self->reader;
+  while (self->running) {
+    try {
+      auto msg = json::from_cbor(in, false);
+      self->record_inbound();
+      std::unique_lock<std::mutex> lock(self->in_mutex);
+      self->in_messages.push_back(std::move(msg));
+      self->stats.frames += 1;
+      self->stats.queue_high_water = std::max(
+          self->stats.queue_high_water, (uint64_t)self->in_messages.size());
+      lock.unlock();
+      self->notify(self->notify_ptr);
+    } catch (json::parse_error &e) {
+      std::cerr << "parse_error: " << e.what() << std::endl;
+      self->record_inbound();
+      std::unique_lock<std::mutex> lock(self->in_mutex);
+      self->stats.malformed_frames += 1;
+      lock.unlock();
+      if (in.fail() || in.eof()) {
+        self->running = false;
+      }
+    }
+  }
+}
+
+ThreadedJsonInterface::ThreadedJsonInterface(
+    std::shared_ptr<std::istream> is, std::shared_ptr<std::ostream> os,
+    viaems::Connection::notify_cb notify, void *ptr,
+    std::shared_ptr<WireCapture> capture)
+    : writer{os}, reader{is}, notify{notify}, notify_ptr{ptr},
+      capture{capture} {
+  if (capture) {
+    capture_buf = std::make_unique<CaptureInbuf>(reader->rdbuf());
+    capture_reader = std::make_unique<std::istream>(capture_buf.get());
+  }
+  running = true;
+  this->reader_thread = std::thread(
+      [](ThreadedJsonInterface *s) { s->do_reader_thread(s); }, this);
+}
+
+ThreadedJsonInterface::~ThreadedJsonInterface() {
+  running = false;
+  reader_thread.join();
+}
+
+void ThreadedJsonInterface::Write(const json &msg) {
+  auto bytes = json::to_cbor(msg);
+  if (capture) {
+    capture->Record(WireDirection::Outbound, bytes.data(), bytes.size());
+  }
+  writer->write((const char *)bytes.data(), bytes.size());
+  writer->flush();
+}
+
+std::optional<json> ThreadedJsonInterface::Read() {
+  std::unique_lock<std::mutex> lock(in_mutex);
+  if (in_messages.empty()) {
+    return {};
+  }
+  auto msg = std::move(in_messages[0]);
+  in_messages.pop_front();
+  return msg;
+}
+
+ConnectionStats ThreadedJsonInterface::Stats() {
+  std::unique_lock<std::mutex> lock(in_mutex);
+  return stats;
+}
+
+ExecConnection::ExecConnection(notify_cb notify, void *ptr, std::string path,
+                               std::shared_ptr<WireCapture> capture) {
+  stream = std::make_shared<redi::pstream>(path);
+  conn = std::make_unique<ThreadedJsonInterface>(stream, stream, notify, ptr,
+                                                 capture);
+}
+
+bool DevConnection::set_raw_mode() {
+  struct termios tty;
+  if (tcgetattr(fd, &tty) != 0) {
+    return false;
+  }
+
+  cfmakeraw(&tty);
+  if (tcsetattr(fd, 0, &tty) != 0) {
+    return false;
+  }
+  return true;
+}
+
+DevConnection::DevConnection(notify_cb notify, void *ptr, std::string path,
+                             std::shared_ptr<WireCapture> capture) {
+  fd = open(path.c_str(), O_RDWR);
+  if (fd < 0) {
+    throw std::runtime_error{"Failed to open device"};
+  }
+  set_raw_mode();
+  istream = std::make_unique<fdistream>(fd);
+  ostream = std::make_unique<fdostream>(fd);
+  conn = std::make_unique<ThreadedJsonInterface>(istream, ostream, notify, ptr,
+                                                 capture);
+}
+
+DevConnection::~DevConnection() { close(fd); }
+
+UdpConnection::UdpConnection(notify_cb notify, void *ptr,
+                             std::shared_ptr<WireCapture> capture,
+                             std::string local_addr, uint16_t local_port,
+                             std::string target_addr, uint16_t target_port) {
+  fd = socket(AF_INET, SOCK_DGRAM, 0);
+  if (fd < 0) {
+    throw std::runtime_error{"Failed to open socket"};
+  }
+
+  struct sockaddr_in sockaddr;
+  sockaddr.sin_family = AF_INET;
+  sockaddr.sin_addr.s_addr = inet_addr(local_addr.c_str());
+  sockaddr.sin_port = htons(local_port);
+  if (bind(fd, (struct sockaddr *)&sockaddr, sizeof(sockaddr)) < 0) {
+    throw std::runtime_error{"Failed to bind"};
+  }
+
+  sockaddr.sin_addr.s_addr = inet_addr(target_addr.c_str());
+  sockaddr.sin_port = htons(target_port);
+  if (connect(fd, (struct sockaddr *)&sockaddr, sizeof(sockaddr)) < 0) {
+    throw std::runtime_error{"Failed to connect"};
+  }
+
+  istream = std::make_unique<fdistream>(fd);
+  ostream = std::make_unique<fdostream>(fd);
+  conn = std::make_unique<ThreadedJsonInterface>(istream, ostream, notify, ptr,
+                                                 capture);
+}
+
+UdpConnection::~UdpConnection() { close(fd); }
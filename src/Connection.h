@@ -0,0 +1,99 @@
+#pragma once
+
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#include <pstream.h>
+
+#include "WireCapture.h"
+#include "fdstream.h"
+#include "viaems.h"
+
+/* Decodes CBOR messages from a stream on a background thread. notify is
+ * called from that thread whenever a message has been queued, and the
+ * messages are then collected with Read() */
+struct ThreadedJsonInterface {
+  std::shared_ptr<std::ostream> writer;
+  std::shared_ptr<std::istream> reader;
+
+  std::thread reader_thread;
+  std::deque<json> in_messages;
+  std::mutex in_mutex;
+  ConnectionStats stats;
+  viaems::Connection::notify_cb notify;
+  void *notify_ptr;
+
+  std::atomic<bool> running;
+
+  std::shared_ptr<WireCapture> capture;
+  std::unique_ptr<CaptureInbuf> capture_buf;
+  std::unique_ptr<std::istream> capture_reader;
+
+  void record_inbound();
+  static void do_reader_thread(ThreadedJsonInterface *self);
+
+public:
+  ThreadedJsonInterface(std::shared_ptr<std::istream> is,
+                        std::shared_ptr<std::ostream> os,
+                        viaems::Connection::notify_cb notify, void *ptr,
+                        std::shared_ptr<WireCapture> capture = nullptr);
+  ~ThreadedJsonInterface();
+
+  void Write(const json &msg);
+  std::optional<json> Read();
+  ConnectionStats Stats();
+};
+
+class ExecConnection : public viaems::Connection {
+  std::shared_ptr<redi::pstream> stream;
+  std::unique_ptr<ThreadedJsonInterface> conn;
+
+public:
+  ExecConnection(notify_cb notify, void *ptr, std::string path,
+                 std::shared_ptr<WireCapture> capture = nullptr);
+
+  virtual void Write(const json &msg) { conn->Write(msg); }
+  virtual std::optional<json> Read() { return conn->Read(); }
+  virtual ConnectionStats Stats() { return conn->Stats(); }
+};
+
+class DevConnection : public viaems::Connection {
+  std::unique_ptr<ThreadedJsonInterface> conn;
+  int fd;
+  std::shared_ptr<fdistream> istream;
+  std::shared_ptr<fdostream> ostream;
+
+  bool set_raw_mode();
+
+public:
+  DevConnection(notify_cb notify, void *ptr, std::string path,
+                std::shared_ptr<WireCapture> capture = nullptr);
+
+  virtual ~DevConnection();
+  virtual void Write(const json &msg) { conn->Write(msg); }
+  virtual std::optional<json> Read() { return conn->Read(); }
+  virtual ConnectionStats Stats() { return conn->Stats(); }
+};
+
+class UdpConnection : public viaems::Connection {
+  std::unique_ptr<ThreadedJsonInterface> conn;
+  int fd;
+  std::shared_ptr<fdistream> istream;
+  std::shared_ptr<fdostream> ostream;
+
+public:
+  UdpConnection(notify_cb notify, void *ptr,
+                std::shared_ptr<WireCapture> capture = nullptr,
+                std::string local_addr = "127.0.0.1",
+                uint16_t local_port = 5556,
+                std::string target_addr = "127.0.0.1",
+                uint16_t target_port = 5555);
+
+  virtual ~UdpConnection();
+  virtual void Write(const json &msg) { conn->Write(msg); }
+  virtual std::optional<json> Read() { return conn->Read(); }
+  virtual ConnectionStats Stats() { return conn->Stats(); }
+};
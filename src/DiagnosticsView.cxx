@@ -0,0 +1,23 @@
+#include "DiagnosticsView.h"
+
+DiagnosticsWindow::DiagnosticsWindow(int X, int Y, int W, int H)
+    : Fl_Double_Window(X, Y, W, H, "Diagnostics") {
+  reset = new Fl_Button(W - 75, 5, 70, 25, "Reset");
+
+  buffer = new Fl_Text_Buffer();
+  display = new Fl_Text_Display(0, 35, W, H - 35);
+  display->buffer(buffer);
+  display->textfont(FL_COURIER);
+  display->textsize(12);
+  resizable(display);
+  end();
+}
+
+DiagnosticsWindow::~DiagnosticsWindow() {
+  display->buffer(nullptr);
+  delete buffer;
+}
+
+void DiagnosticsWindow::update(const ProtocolMetrics &metrics) {
+  buffer->text(format_metrics(metrics).c_str());
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <FL/Fl.H>
+#include <FL/Fl_Button.H>
+#include <FL/Fl_Double_Window.H>
+#include <FL/Fl_Text_Buffer.H>
+#include <FL/Fl_Text_Display.H>
+
+#include "Metrics.h"
+
+/* Shows a summary of the protocol metrics */
+class DiagnosticsWindow : public Fl_Double_Window {
+public:
+  DiagnosticsWindow(int X, int Y, int W, int H);
+  ~DiagnosticsWindow();
+
+  void update(const ProtocolMetrics &metrics);
+
+  /* Called when the user asks for the metrics to be reset */
+  void reset_callback(Fl_Callback *cb, void *ptr) { reset->callback(cb, ptr); }
+
+private:
+  Fl_Button *reset;
+  Fl_Text_Display *display;
+  Fl_Text_Buffer *buffer;
+};
@@ -1,5 +1,6 @@
 #include <iostream>
 #include <set>
+#include <sstream>
 
 #include <sqlite3.h>
 
@@ -100,11 +101,48 @@ static void ensure_db_schema(sqlite3 *db, const viaems::LogChunk &update) {
   }
 }
 
+static uint64_t time_to_ns(std::chrono::system_clock::time_point t) {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             t.time_since_epoch())
+      .count();
+}
+
+static void write_gaps(sqlite3 *db, const std::vector<viaems::FeedGap> &gaps) {
+  std::string query = "INSERT INTO gaps VALUES(?, ?, ?);";
+  sqlite3_stmt *stmt;
+  int res = sqlite3_prepare_v2(db, query.c_str(), query.size(), &stmt, NULL);
+  if (res != SQLITE_OK) {
+    std::cerr << "Log: unable to prepare gap insert statement: "
+              << sqlite3_errmsg(db) << std::endl;
+    return;
+  }
+
+  for (const auto &gap : gaps) {
+    sqlite3_reset(stmt);
+    sqlite3_bind_int64(stmt, 1, time_to_ns(gap.start));
+    sqlite3_bind_int64(stmt, 2, time_to_ns(gap.end));
+    sqlite3_bind_int64(stmt, 3, gap.lost_samples);
+    if (sqlite3_step(stmt) != SQLITE_DONE) {
+      std::cerr << "Log: unable to insert gap: " << sqlite3_errmsg(db)
+                << std::endl;
+      break;
+    }
+  }
+  sqlite3_finalize(stmt);
+}
+
 void Log::WriteChunk(viaems::LogChunk &&update) {
   if (!db) {
     return;
   }
 
+  if (!update.gaps.empty()) {
+    write_gaps(db, update.gaps);
+  }
+  if (update.points.empty()) {
+    return;
+  }
+
   ensure_db_schema(this->db, update);
 
   auto query = points_table_insert_query(update.keys);
@@ -150,7 +188,150 @@ void Log::WriteChunk(viaems::LogChunk &&update) {
   sqlite3_finalize(insert_stmt);
 }
 
-Log::Log(std::string path) {
+/* Stores config json once per distinct content, returning its hash */
+static std::optional<std::string> store_config_blob(sqlite3 *db,
+                                                    const std::string &config) {
+  auto hash = viaems::fnv1a_hex(
+      reinterpret_cast<const uint8_t *>(config.data()), config.size());
+
+  std::string query = "INSERT OR IGNORE INTO config_blobs VALUES(?, ?, ?);";
+  sqlite3_stmt *stmt;
+  int res = sqlite3_prepare_v2(db, query.c_str(), query.size(), &stmt, NULL);
+  if (res != SQLITE_OK) {
+    std::cerr << "Log: unable to prepare config insert statement: "
+              << sqlite3_errmsg(db) << std::endl;
+    return {};
+  }
+  sqlite3_bind_text(stmt, 1, hash.c_str(), hash.size(), SQLITE_STATIC);
+  sqlite3_bind_int64(stmt, 2, config.size());
+  sqlite3_bind_text(stmt, 3, config.c_str(), config.size(), SQLITE_STATIC);
+  res = sqlite3_step(stmt);
+  sqlite3_finalize(stmt);
+  if (res != SQLITE_DONE) {
+    std::cerr << "Log: unable to save config: " << sqlite3_errmsg(db)
+              << std::endl;
+    return {};
+  }
+  if (sqlite3_changes(db) > 0) {
+    return hash;
+  }
+
+  /* Already stored. Make sure it really is the same config */
+  query = "SELECT config = ? FROM config_blobs WHERE hash = ?;";
+  sqlite3_prepare_v2(db, query.c_str(), query.size(), &stmt, NULL);
+  sqlite3_bind_text(stmt, 1, config.c_str(), config.size(), SQLITE_STATIC);
+  sqlite3_bind_text(stmt, 2, hash.c_str(), hash.size(), SQLITE_STATIC);
+  bool same = (sqlite3_step(stmt) == SQLITE_ROW) &&
+              (sqlite3_column_int(stmt, 0) == 1);
+  sqlite3_finalize(stmt);
+  if (!same) {
+    std::cerr << "Log: config hash collision, not saved: " << hash
+              << std::endl;
+    return {};
+  }
+  return hash;
+}
+
+static bool insert_config_save(sqlite3 *db, int64_t time_ns,
+                               const std::string &name,
+                               const std::string &hash) {
+  std::string query = "INSERT INTO config_saves VALUES(?, ?, ?);";
+  sqlite3_stmt *stmt;
+  int res = sqlite3_prepare_v2(db, query.c_str(), query.size(), &stmt, NULL);
+  if (res != SQLITE_OK) {
+    std::cerr << "Log: unable to prepare config insert statement: "
+              << sqlite3_errmsg(db) << std::endl;
+    return false;
+  }
+  sqlite3_bind_int64(stmt, 1, time_ns);
+  sqlite3_bind_text(stmt, 2, name.c_str(), name.size(), SQLITE_STATIC);
+  sqlite3_bind_text(stmt, 3, hash.c_str(), hash.size(), SQLITE_STATIC);
+  bool ok = sqlite3_step(stmt) == SQLITE_DONE;
+  if (!ok) {
+    std::cerr << "Log: unable to save config: " << sqlite3_errmsg(db)
+              << std::endl;
+  }
+  sqlite3_finalize(stmt);
+  return ok;
+}
+
+static bool has_table(sqlite3 *db, const std::string &name) {
+  std::string query =
+      "SELECT 1 FROM sqlite_master WHERE type = 'table' AND name = ?";
+  sqlite3_stmt *stmt;
+  if (sqlite3_prepare_v2(db, query.c_str(), query.size(), &stmt, NULL) !=
+      SQLITE_OK) {
+    return false;
+  }
+  sqlite3_bind_text(stmt, 1, name.c_str(), name.size(), SQLITE_STATIC);
+  bool exists = sqlite3_step(stmt) == SQLITE_ROW;
+  sqlite3_finalize(stmt);
+  return exists;
+}
+
+/* Saves as (time, name, hash, size, config), including those of a legacy
+ * configs table that was not migrated, such as in a log opened read-only.
+ * Empty if the log has no saves at all */
+static std::string saved_configs_query(sqlite3 *db) {
+  std::string query;
+  if (has_table(db, "config_saves") && has_table(db, "config_blobs")) {
+    query = "SELECT s.time AS time, s.name AS name, s.hash AS hash, "
+            "b.size AS size, b.config AS config FROM config_saves s "
+            "JOIN config_blobs b ON b.hash = s.hash";
+  }
+  if (has_table(db, "configs")) {
+    if (!query.empty()) {
+      query += " UNION ALL ";
+    }
+    query += "SELECT time, name, '', length(CAST(config AS BLOB)), config "
+             "FROM configs";
+  }
+  return query;
+}
+
+/* Logs from before content addressing kept a full copy per save in the
+ * configs table. Move those into config_blobs and config_saves, all or
+ * nothing: if any save can't be moved the legacy table is kept as is */
+static void migrate_configs_table(sqlite3 *db) {
+  if (!has_table(db, "configs")) {
+    return;
+  }
+
+  sqlite3_exec(db, "BEGIN;", NULL, 0, NULL);
+  std::string query = "SELECT time, name, config FROM configs";
+  sqlite3_stmt *stmt;
+  sqlite3_prepare_v2(db, query.c_str(), query.size(), &stmt, NULL);
+  bool migrated = true;
+  while (migrated && (sqlite3_step(stmt) == SQLITE_ROW)) {
+    auto name = sqlite3_column_text(stmt, 1);
+    auto config = sqlite3_column_text(stmt, 2);
+    if (config == nullptr) {
+      continue;
+    }
+    auto hash = store_config_blob(db, reinterpret_cast<const char *>(config));
+    migrated = hash && insert_config_save(
+                           db, sqlite3_column_int64(stmt, 0),
+                           name ? reinterpret_cast<const char *>(name) : "",
+                           *hash);
+  }
+  sqlite3_finalize(stmt);
+  if (!migrated) {
+    std::cerr << "Log: unable to migrate configs table, keeping it"
+              << std::endl;
+    sqlite3_exec(db, "ROLLBACK;", NULL, 0, NULL);
+    return;
+  }
+
+  char *sqlerr;
+  if (sqlite3_exec(db, "DROP TABLE configs; COMMIT;", NULL, 0, &sqlerr)) {
+    std::cerr << "Log: unable to migrate configs table: " << sqlerr
+              << std::endl;
+    sqlite3_free(sqlerr);
+    sqlite3_exec(db, "ROLLBACK;", NULL, 0, NULL);
+  }
+}
+
+Log::Log(std::string path, bool writer) {
   int r = sqlite3_open(path.c_str(), &db);
   if (r) {
     db = nullptr;
@@ -166,6 +347,52 @@ Log::Log(std::string path) {
     std::cerr << "Log: unable to set WAL mode: " << sqlerr << std::endl;
     sqlite3_free(sqlerr);
   }
+
+  res = sqlite3_exec(db,
+                     "CREATE TABLE IF NOT EXISTS gaps (start_ns INTEGER, "
+                     "end_ns INTEGER, lost INTEGER);"
+                     "CREATE INDEX IF NOT EXISTS gaps_time ON gaps(start_ns);",
+                     NULL, 0, &sqlerr);
+  if (res) {
+    std::cerr << "Log: unable to create gaps table: " << sqlerr << std::endl;
+    sqlite3_free(sqlerr);
+  }
+
+  /* Saved configs are stored once per distinct content, and each save
+   * refers to its content by hash */
+  res = sqlite3_exec(
+      db,
+      "CREATE TABLE IF NOT EXISTS config_blobs (hash TEXT PRIMARY KEY, "
+      "size INTEGER, config TEXT);"
+      "CREATE TABLE IF NOT EXISTS config_saves (time INTEGER, name TEXT, "
+      "hash TEXT);"
+      "CREATE INDEX IF NOT EXISTS config_saves_time ON config_saves(time);",
+      NULL, 0, &sqlerr);
+  if (res) {
+    std::cerr << "Log: unable to create config tables: " << sqlerr
+              << std::endl;
+    sqlite3_free(sqlerr);
+  }
+  /* Only a writer rewrites the file, a log opened to view it is left as is */
+  if (writer && !sqlite3_db_readonly(db, "main")) {
+    migrate_configs_table(db);
+  }
+
+  /* Every config value as it changed, indexed to find a path's value at a
+   * time and the changes within a time range */
+  res = sqlite3_exec(
+      db,
+      "CREATE TABLE IF NOT EXISTS config_values (time INTEGER, path TEXT, "
+      "value TEXT, first INTEGER);"
+      "CREATE INDEX IF NOT EXISTS config_values_path ON "
+      "config_values(path, time);"
+      "CREATE INDEX IF NOT EXISTS config_values_time ON config_values(time);",
+      NULL, 0, &sqlerr);
+  if (res) {
+    std::cerr << "Log: unable to create config values table: " << sqlerr
+              << std::endl;
+    sqlite3_free(sqlerr);
+  }
 }
 
 static std::string table_search_statement(std::vector<std::string> keys) {
@@ -232,6 +459,34 @@ viaems::LogChunk Log::GetRange(std::vector<std::string> keys,
   return retval;
 }
 
+std::vector<viaems::FeedGap>
+Log::GetGaps(std::chrono::system_clock::time_point start,
+             std::chrono::system_clock::time_point end) {
+  if (db == nullptr) {
+    return {};
+  }
+
+  std::string query = "SELECT start_ns, end_ns, lost FROM gaps WHERE "
+                      "end_ns > ? AND start_ns < ? ORDER BY start_ns";
+  sqlite3_stmt *stmt;
+  sqlite3_prepare_v2(db, query.c_str(), query.size(), &stmt, NULL);
+  sqlite3_bind_int64(stmt, 1, time_to_ns(start));
+  sqlite3_bind_int64(stmt, 2, time_to_ns(end));
+
+  std::vector<viaems::FeedGap> gaps;
+  while (sqlite3_step(stmt) == SQLITE_ROW) {
+    auto gap_start = std::chrono::nanoseconds{sqlite3_column_int64(stmt, 0)};
+    auto gap_end = std::chrono::nanoseconds{sqlite3_column_int64(stmt, 1)};
+    gaps.push_back(viaems::FeedGap{
+        .start = std::chrono::system_clock::time_point{gap_start},
+        .end = std::chrono::system_clock::time_point{gap_end},
+        .lost_samples = (uint32_t)sqlite3_column_int64(stmt, 2),
+    });
+  }
+  sqlite3_finalize(stmt);
+  return gaps;
+}
+
 std::chrono::system_clock::time_point Log::EndTime() {
   std::string query =
       "SELECT realtime_ns FROM points ORDER BY realtime_ns DESC LIMIT 1";
@@ -264,95 +519,214 @@ std::chrono::system_clock::time_point Log::StartTime() {
   return time;
 }
 
-static void ensure_configs_table(sqlite3 *db) {
-  std::string create_table_str =
-      "CREATE TABLE configs (time INTEGER, name TEXT, config TEXT);";
-
-  int res;
-  char *sqlerr;
-  res = sqlite3_exec(db, create_table_str.c_str(), NULL, 0, &sqlerr);
-  if (res) {
-    std::cerr << "Log: unable to create configs table: " << sqlerr << std::endl;
-    sqlite3_free(sqlerr);
-    return;
+void Log::SaveConfig(viaems::Configuration conf) {
+  std::ostringstream conf_stream;
+  conf.write_json(conf_stream);
+  auto hash = store_config_blob(db, conf_stream.str());
+  if (hash) {
+    insert_config_save(db, time_to_ns(conf.save_time), conf.name, *hash);
   }
 }
 
-void Log::SaveConfig(viaems::Configuration conf) {
-  ensure_configs_table(db);
-
-  std::string insert_query_str = "INSERT INTO configs VALUES(?, ?, ?);";
-  sqlite3_stmt *insert_stmt;
-  int res = sqlite3_prepare_v2(db, insert_query_str.c_str(),
-                               insert_query_str.size(), &insert_stmt, NULL);
-
+std::vector<SavedConfigInfo> Log::ListConfigs() {
+  auto saves = saved_configs_query(db);
+  if (saves.empty()) {
+    return {};
+  }
+  std::string select_query_str = "SELECT time, name, hash, size FROM (" +
+                                 saves + ") ORDER BY time DESC";
+  sqlite3_stmt *select_stmt;
+  int res = sqlite3_prepare_v2(db, select_query_str.c_str(),
+                               select_query_str.size(), &select_stmt, NULL);
   if (res != SQLITE_OK) {
-    std::cerr << "Log: unable to prepare insert statement: "
+    std::cerr << "Log: unable to prepare config query statement: "
               << sqlite3_errmsg(db) << std::endl;
-    return;
+    return {};
   }
 
-  sqlite3_reset(insert_stmt);
-  uint64_t time_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
-                         conf.save_time.time_since_epoch())
-                         .count();
-  sqlite3_bind_int64(insert_stmt, 1, time_ns);
-
-  sqlite3_bind_text(insert_stmt, 2, conf.name.c_str(), conf.name.size(),
-                    SQLITE_STATIC);
-
-  std::string conf_dump = conf.to_json().dump();
-  sqlite3_bind_text(insert_stmt, 3, conf_dump.c_str(), conf_dump.size(),
-                    SQLITE_STATIC);
-
-  res = sqlite3_step(insert_stmt);
-  if (res != SQLITE_DONE) {
-    std::cerr << "Log: unable to save config: " << sqlite3_errmsg(db)
-              << std::endl;
-    return;
+  std::vector<SavedConfigInfo> configs;
+  while (sqlite3_step(select_stmt) == SQLITE_ROW) {
+    auto ns = sqlite3_column_int64(select_stmt, 0);
+    auto name = sqlite3_column_text(select_stmt, 1);
+    auto hash = sqlite3_column_text(select_stmt, 2);
+    configs.push_back(SavedConfigInfo{
+        .save_time =
+            std::chrono::system_clock::time_point{std::chrono::nanoseconds{ns}},
+        .name = name ? reinterpret_cast<const char *>(name) : "",
+        .hash = hash ? reinterpret_cast<const char *>(hash) : "",
+        .size = (size_t)sqlite3_column_int64(select_stmt, 3),
+    });
   }
-  sqlite3_finalize(insert_stmt);
+  sqlite3_finalize(select_stmt);
+  return configs;
 }
 
-std::vector<viaems::Configuration> Log::LoadConfigs() {
-  ensure_configs_table(db);
-
+std::optional<viaems::Configuration>
+Log::LoadConfig(std::chrono::system_clock::time_point save_time) {
+  auto saves = saved_configs_query(db);
+  if (saves.empty()) {
+    return {};
+  }
   std::string select_query_str =
-      "SELECT time, name, config FROM configs ORDER BY time DESC";
+      "SELECT name, config FROM (" + saves + ") WHERE time = ? LIMIT 1";
   sqlite3_stmt *select_stmt;
   int res = sqlite3_prepare_v2(db, select_query_str.c_str(),
                                select_query_str.size(), &select_stmt, NULL);
-  std::vector<viaems::Configuration> configs;
-
   if (res != SQLITE_OK) {
     std::cerr << "Log: unable to prepare config query statement: "
               << sqlite3_errmsg(db) << std::endl;
     return {};
   }
+  sqlite3_bind_int64(select_stmt, 1, time_to_ns(save_time));
+
+  std::optional<viaems::Configuration> config;
+  if (sqlite3_step(select_stmt) == SQLITE_ROW) {
+    auto name = sqlite3_column_text(select_stmt, 0);
+    config = viaems::Configuration{
+        .save_time = save_time,
+        .name = name ? reinterpret_cast<const char *>(name) : "",
+    };
+    try {
+      config->from_json(json::parse(reinterpret_cast<const char *>(
+          sqlite3_column_text(select_stmt, 1))));
+    } catch (json::exception &e) {
+      std::cerr << "Log: unable to parse saved config: " << e.what()
+                << std::endl;
+      config.reset();
+    }
+  }
+  sqlite3_finalize(select_stmt);
+  return config;
+}
 
-  sqlite3_reset(select_stmt);
-  do {
-    res = sqlite3_step(select_stmt);
-    if (res != SQLITE_ROW) {
-      break;
+static std::string path_key(const viaems::StructurePath &path) {
+  json j = json::array();
+  for (const auto &p : path) {
+    if (std::holds_alternative<int>(p)) {
+      j.push_back(std::get<int>(p));
+    } else {
+      j.push_back(std::get<std::string>(p));
     }
+  }
+  return j.dump();
+}
 
-    auto ns = sqlite3_column_int64(select_stmt, 0);
-    auto time_ns =
-        std::chrono::system_clock::time_point{std::chrono::nanoseconds{ns}};
+static viaems::StructurePath path_from_key(const std::string &key) {
+  viaems::StructurePath path;
+  for (const auto &p : json::parse(key)) {
+    if (p.is_number_integer()) {
+      path.push_back(p.get<int>());
+    } else {
+      path.push_back(p.get<std::string>());
+    }
+  }
+  return path;
+}
 
-    std::string config_name =
-        reinterpret_cast<const char *>(sqlite3_column_text(select_stmt, 1));
+/* Latest recorded json of path no later than time_ns */
+static std::optional<std::string>
+config_value_text_at(sqlite3 *db, const std::string &path, int64_t time_ns) {
+  std::string query = "SELECT value FROM config_values WHERE path = ? AND "
+                      "time <= ? ORDER BY time DESC LIMIT 1";
+  sqlite3_stmt *stmt;
+  if (sqlite3_prepare_v2(db, query.c_str(), query.size(), &stmt, NULL) !=
+      SQLITE_OK) {
+    std::cerr << "Log: unable to prepare config value query: "
+              << sqlite3_errmsg(db) << std::endl;
+    return {};
+  }
+  sqlite3_bind_text(stmt, 1, path.c_str(), path.size(), SQLITE_STATIC);
+  sqlite3_bind_int64(stmt, 2, time_ns);
+  std::optional<std::string> value;
+  if (sqlite3_step(stmt) == SQLITE_ROW) {
+    value = reinterpret_cast<const char *>(sqlite3_column_text(stmt, 0));
+  }
+  sqlite3_finalize(stmt);
+  return value;
+}
 
-    auto resp =
-        viaems::Configuration{.save_time = time_ns, .name = config_name};
-    auto config_json = json::parse(sqlite3_column_text(select_stmt, 2));
+void Log::RecordConfigValues(std::vector<ConfigValueRecord> &&records) {
+  if ((db == nullptr) || records.empty()) {
+    return;
+  }
 
-    resp.from_json(config_json);
-    configs.push_back(resp);
-  } while (true);
-  sqlite3_finalize(select_stmt);
-  return configs;
+  std::string query = "INSERT INTO config_values VALUES(?, ?, ?, ?);";
+  sqlite3_stmt *stmt;
+  int res = sqlite3_prepare_v2(db, query.c_str(), query.size(), &stmt, NULL);
+  if (res != SQLITE_OK) {
+    std::cerr << "Log: unable to prepare config value insert: "
+              << sqlite3_errmsg(db) << std::endl;
+    return;
+  }
+
+  sqlite3_exec(db, "BEGIN;", NULL, 0, NULL);
+
+  for (const auto &record : records) {
+    auto key = path_key(record.path);
+    auto text = viaems::json_from_value(record.value).dump();
+    auto time_ns = time_to_ns(record.time);
+    auto current = config_value_text_at(db, key, time_ns);
+    if (current && (*current == text)) {
+      continue;
+    }
+
+    sqlite3_reset(stmt);
+    sqlite3_bind_int64(stmt, 1, time_ns);
+    sqlite3_bind_text(stmt, 2, key.c_str(), key.size(), SQLITE_STATIC);
+    sqlite3_bind_text(stmt, 3, text.c_str(), text.size(), SQLITE_STATIC);
+    sqlite3_bind_int(stmt, 4, current ? 0 : 1);
+    if (sqlite3_step(stmt) != SQLITE_DONE) {
+      std::cerr << "Log: unable to record config value: " << sqlite3_errmsg(db)
+                << std::endl;
+    }
+  }
+
+  sqlite3_exec(db, "COMMIT;", NULL, 0, NULL);
+  sqlite3_finalize(stmt);
+}
+
+std::optional<viaems::ConfigValue>
+Log::ConfigValueAt(const viaems::StructurePath &path,
+                   std::chrono::system_clock::time_point time) {
+  if (db == nullptr) {
+    return {};
+  }
+  auto text = config_value_text_at(db, path_key(path), time_to_ns(time));
+  if (!text) {
+    return {};
+  }
+  return viaems::value_from_json(json::parse(*text));
+}
+
+std::vector<ConfigChange>
+Log::GetConfigChanges(std::chrono::system_clock::time_point start,
+                      std::chrono::system_clock::time_point end) {
+  if (db == nullptr) {
+    return {};
+  }
+  std::string query = "SELECT time, path FROM config_values WHERE time >= ? "
+                      "AND time <= ? AND first = 0 ORDER BY time";
+  sqlite3_stmt *stmt;
+  if (sqlite3_prepare_v2(db, query.c_str(), query.size(), &stmt, NULL) !=
+      SQLITE_OK) {
+    std::cerr << "Log: unable to prepare config change query: "
+              << sqlite3_errmsg(db) << std::endl;
+    return {};
+  }
+  sqlite3_bind_int64(stmt, 1, time_to_ns(start));
+  sqlite3_bind_int64(stmt, 2, time_to_ns(end));
+
+  std::vector<ConfigChange> changes;
+  while (sqlite3_step(stmt) == SQLITE_ROW) {
+    auto ns = std::chrono::nanoseconds{sqlite3_column_int64(stmt, 0)};
+    changes.push_back(ConfigChange{
+        .time = std::chrono::system_clock::time_point{ns},
+        .path = path_from_key(
+            reinterpret_cast<const char *>(sqlite3_column_text(stmt, 1))),
+    });
+  }
+  sqlite3_finalize(stmt);
+  return changes;
 }
 
 std::vector<std::string> Log::Keys() const { return current_points_keys(db); }
@@ -363,17 +737,33 @@ void ThreadedWriteLog::WriteChunk(viaems::LogChunk &&chunk) {
   cv.notify_one();
 }
 
+void ThreadedWriteLog::RecordConfigValues(
+    std::vector<ConfigValueRecord> &&records) {
+  std::unique_lock<std::mutex> lock(mutex);
+  config_values.emplace_back(std::move(records));
+  cv.notify_one();
+}
+
 void ThreadedWriteLog::write_loop() {
   while (true) {
     std::unique_lock<std::mutex> lock(mutex);
-    if (running && chunks.empty()) {
-      cv.wait(lock);
-    }
+    cv.wait(lock, [this]() {
+      return !running || !chunks.empty() || !config_values.empty();
+    });
 
-    if (!running) {
+    /* Drain anything still queued before stopping */
+    if (chunks.empty() && config_values.empty()) {
       return;
     }
 
+    if (!config_values.empty()) {
+      auto records = std::move(config_values.front());
+      config_values.pop_front();
+      lock.unlock();
+      Log::RecordConfigValues(std::move(records));
+      continue;
+    }
+
     auto first = std::move(chunks.front());
     chunks.erase(chunks.begin());
 
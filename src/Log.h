@@ -15,11 +15,35 @@
 
 #include "viaems.h"
 
+/* A saved configuration, without its contents */
+struct SavedConfigInfo {
+  std::chrono::system_clock::time_point save_time;
+  std::string name;
+  /* Of the json, equal for equal configs. Empty for a save still in the
+   * configs table of a legacy log that was not migrated */
+  std::string hash;
+  size_t size;      /* Bytes of json */
+};
+
+/* A recorded config value that replaced an earlier one */
+struct ConfigChange {
+  std::chrono::system_clock::time_point time;
+  viaems::StructurePath path;
+};
+
+/* A config value to record in the timeline */
+struct ConfigValueRecord {
+  std::chrono::system_clock::time_point time;
+  viaems::StructurePath path;
+  viaems::ConfigValue value;
+};
+
 class Log {
   sqlite3 *db;
 
 public:
-  Log(std::string path);
+  /* A writer also migrates the saved configs of older logs */
+  Log(std::string path, bool writer = false);
   Log(const Log &) = delete;
   Log &operator=(const Log &) = delete;
   ~Log() {
@@ -35,8 +59,28 @@ public:
                             std::chrono::system_clock::time_point end);
   std::vector<std::string> Keys() const;
 
+  /* Feed gaps overlapping the given range */
+  std::vector<viaems::FeedGap>
+  GetGaps(std::chrono::system_clock::time_point start,
+          std::chrono::system_clock::time_point end);
+
   void SaveConfig(viaems::Configuration);
-  std::vector<viaems::Configuration> LoadConfigs();
+  /* Saved configurations, newest first. Only reads the metadata */
+  std::vector<SavedConfigInfo> ListConfigs();
+  std::optional<viaems::Configuration>
+  LoadConfig(std::chrono::system_clock::time_point save_time);
+
+  /* Timeline of config values, written in one transaction. A value is only
+   * recorded if it differs from the value of its path at that time */
+  void RecordConfigValues(std::vector<ConfigValueRecord> &&);
+  /* Value of path as of time, by index lookup */
+  std::optional<viaems::ConfigValue>
+  ConfigValueAt(const viaems::StructurePath &path,
+                std::chrono::system_clock::time_point time);
+  /* Changes recorded within a range, excluding the first value of a path */
+  std::vector<ConfigChange>
+  GetConfigChanges(std::chrono::system_clock::time_point start,
+                   std::chrono::system_clock::time_point end);
 
   std::chrono::system_clock::time_point EndTime();
   std::chrono::system_clock::time_point StartTime();
@@ -46,6 +90,7 @@ class ThreadedWriteLog : public Log {
   std::mutex mutex;
   std::condition_variable cv;
   std::deque<viaems::LogChunk> chunks;
+  std::deque<std::vector<ConfigValueRecord>> config_values;
   std::thread thread;
   std::atomic<bool> running;
 
@@ -60,10 +105,11 @@ public:
     thread.join();
   }
 
-  ThreadedWriteLog(std::string path) : Log(path) {
+  ThreadedWriteLog(std::string path) : Log(path, true) {
     running = true;
     thread = std::thread([](ThreadedWriteLog *w) { w->write_loop(); }, this);
   }
 
   void WriteChunk(viaems::LogChunk &&);
+  void RecordConfigValues(std::vector<ConfigValueRecord> &&);
 };
@@ -56,6 +56,9 @@ void LogView::update_cache_time_range() {
   if (!log_locked) {
     return;
   }
+  gaps = log_locked->GetGaps(new_start, new_stop);
+  config_changes = log_locked->GetConfigChanges(new_start, new_stop);
+
   if ((keys != cache.keys) || !cache.points.size()) {
     cache = log_locked->GetRange(keys, new_start, new_stop);
   } else {
@@ -183,10 +186,83 @@ void LogView::recompute_pointgroups(int x1, int x2) {
   };
 }
 
+/* Pixels that lie within a feed gap. The pixel a gap starts in still holds
+ * the samples before it, so is not included */
+std::vector<bool> LogView::gap_pixels() {
+  std::vector<bool> result(w(), false);
+  if (stop_ns <= start_ns) {
+    return result;
+  }
+  double pixels_per_ns = w() / (double)(stop_ns - start_ns);
+  for (const auto &gap : gaps) {
+    int64_t gap_start = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                            gap.start.time_since_epoch())
+                            .count();
+    int64_t gap_end = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                          gap.end.time_since_epoch())
+                          .count();
+    double x1 = (gap_start - (int64_t)start_ns) * pixels_per_ns + 1;
+    double x2 = (gap_end - (int64_t)start_ns) * pixels_per_ns;
+    x1 = std::max(x1, 0.0);
+    x2 = std::min(x2, w() - 1.0);
+    for (int px = x1; px <= x2; px++) {
+      result[px] = true;
+    }
+  }
+  return result;
+}
+
+/* Mark where config values were changed, labelled with the path. Labels
+ * that would overlap the previous one are left off */
+void LogView::draw_config_changes() {
+  if (stop_ns <= start_ns) {
+    return;
+  }
+  double pixels_per_ns = w() / (double)(stop_ns - start_ns);
+  int label_end = 0;
+  fl_color(FL_YELLOW);
+  fl_line_style(FL_DOT);
+  for (const auto &change : config_changes) {
+    int64_t change_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                            change.time.time_since_epoch())
+                            .count();
+    int px = (change_ns - (int64_t)start_ns) * pixels_per_ns;
+    if ((px < 0) || (px >= w())) {
+      continue;
+    }
+    fl_line(x() + px, y(), x() + px, y() + h());
+
+    std::string label;
+    for (const auto &p : change.path) {
+      label += label.empty() ? "" : "/";
+      label += std::holds_alternative<int>(p)
+                   ? std::to_string(std::get<int>(p))
+                   : std::get<std::string>(p);
+    }
+    int lw = 0, lh = 0;
+    fl_measure(label.c_str(), lw, lh);
+    if (px + 2 >= label_end) {
+      fl_draw(label.c_str(), x() + px + 2, y() + lh);
+      label_end = px + 2 + lw + 4;
+    }
+  }
+  fl_line_style(0);
+}
+
 void LogView::draw() {
   draw_box();
   fl_push_clip(x(), y(), w(), h());
 
+  /* Shade feed gaps, and don't join points across them */
+  auto breaks = gap_pixels();
+  fl_color(FL_DARK_RED);
+  for (int px = 0; px < w(); px++) {
+    if (breaks[px]) {
+      fl_line(x() + px, y(), x() + px, y() + h());
+    }
+  }
+  draw_config_changes();
+
   int count = 0;
   auto enabled_count = std::count_if(config.begin(), config.end(),
                                      [](auto &x) { return x.second.enabled; });
@@ -226,7 +302,10 @@ void LogView::draw() {
             h() * ((pointgroup.last - conf.min_y) / (conf.max_y - conf.min_y));
 
         fl_line(x() + cx, y() + h() - cymin, x() + cx, y() + h() - cymax);
-        if (last_y >= 0) {
+        auto from = breaks.begin() + std::min<size_t>(last_x + 1, w());
+        auto to = breaks.begin() + std::min<size_t>(cx + 1, w());
+        bool broken = std::find(from, to, true) != to;
+        if ((last_y >= 0) && !broken) {
           fl_line(x() + last_x, y() + h() - last_y, x() + cx,
                   y() + h() - cyfirst);
         }
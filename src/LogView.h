@@ -49,11 +49,15 @@ private:
   std::map<std::string, SeriesConfig> config;
   std::map<std::string, std::vector<PointGroup>> series;
   viaems::LogChunk cache;
+  std::vector<viaems::FeedGap> gaps;
+  std::vector<ConfigChange> config_changes;
 
   int handle(int);
   void recompute_pointgroups(int x1, int x2);
   void shift_pointgroups(int amt);
   void update_cache_time_range();
+  std::vector<bool> gap_pixels();
+  void draw_config_changes();
   void draw();
 
   static void zoom_selection(Fl_Widget *w, void *p);
@@ -72,10 +72,17 @@ public:
     id_box->redraw();
   }
 
+  /* Marks an edit the target didn't take, until the next edit */
+  void rolled_back() {
+    id_box->color(FL_YELLOW);
+    id_box->redraw();
+  }
+
   virtual void update_value(viaems::ConfigValue v) { dirty(false); }
   virtual viaems::ConfigValue get_value() { return (uint32_t)0; }
 
   viaems::StructurePath path;
+  viaems::PathId id = viaems::invalid_path_id;
 };
 
 template <typename T> class NumericTreeWidget : public SelectableTreeWidget {
@@ -187,15 +194,50 @@ public:
   }
 };
 
-static SelectableTreeWidget *
-get_config_tree_widget(Fl_Tree *tree, viaems::StructurePath path) {
-  for (Fl_Tree_Item *item = tree->first(); item; item = item->next()) {
-    auto w = dynamic_cast<SelectableTreeWidget *>(item->widget());
-    if (w && w->path == path) {
-      return w;
+SelectableTreeWidget *
+MainWindow::config_widget(const viaems::StructurePath &path) {
+  auto id = config_widget_paths.find(path);
+  if (!id || (*id >= config_widgets.size())) {
+    return nullptr;
+  }
+  return config_widgets[*id];
+}
+
+void MainWindow::index_config_widget(Fl_Tree_Item *item,
+                                     SelectableTreeWidget *w) {
+  item->widget(w);
+  auto id = config_widget_paths.intern(w->path);
+  if (id >= config_widgets.size()) {
+    config_widgets.resize(id + 1, nullptr);
+  }
+  config_widgets[id] = w;
+  mark_config_widget(w);
+}
+
+void MainWindow::mark_config_widget(SelectableTreeWidget *w) {
+  if (m_model->has_unconfirmed_edits(w->path)) {
+    w->dirty(true);
+  } else if (rolled_back_paths.count(w->path)) {
+    w->rolled_back();
+  }
+}
+
+/* Fl_Tree_Item leaves its widget to the tree, so widgets under an item are
+ * deleted here before the items themselves are cleared */
+void MainWindow::forget_config_widgets(Fl_Tree_Item *item) {
+  for (int i = 0; i < item->children(); i++) {
+    auto child = item->child(i);
+    forget_config_widgets(child);
+    auto w = dynamic_cast<SelectableTreeWidget *>(child->widget());
+    if (w == nullptr) {
+      continue;
+    }
+    if (config_widget(w->path) == w) {
+      config_widgets[*config_widget_paths.find(w->path)] = nullptr;
     }
+    child->widget(nullptr);
+    Fl::delete_widget(w);
   }
-  return nullptr;
 }
 
 MainWindow::MainWindow() : MainWindowUI() {
@@ -261,16 +303,17 @@ MainWindow::MainWindow() : MainWindowUI() {
   m_logview_follow->callback(pause_cb, this);
 }
 
-struct LogMenuData {
-  MainWindow *mw;
-  std::string text;
-  viaems::Configuration config;
-};
-
 void MainWindow::select_prev_config_callback(Fl_Widget *w, void *v) {
-  auto item = (LogMenuData *)v;
-  auto clicked_item = item->mw->m_bar->mvalue();
-  item->mw->load_config_callback(item->config);
+  auto item = (PrevConfigItem *)v;
+  auto mw = item->mw;
+  if (!mw->log) {
+    return;
+  }
+  /* Only the chosen config is read and parsed */
+  auto conf = mw->log.value()->LoadConfig(item->save_time);
+  if (conf) {
+    mw->load_config_callback(*conf);
+  }
 }
 
 void MainWindow::update_log(std::optional<std::shared_ptr<Log>> l) {
@@ -281,20 +324,25 @@ void MainWindow::update_log(std::optional<std::shared_ptr<Log>> l) {
     auto stop_time = l.value()->EndTime();
     auto start_time = l.value()->StartTime(); // stop_time - std::chrono::seconds{20};
     m_logview->update_time_range(start_time, stop_time);
-    auto old_configs = log->LoadConfigs();
 
-    m_file_loadconfig->flags = FL_SUBMENU;
-    prev_config_menu_items.clear();
-    for (const auto &conf : old_configs) {
-      auto time_c = std::chrono::system_clock::to_time_t(conf.save_time);
+    prev_config_items.clear();
+    for (const auto &info : log->ListConfigs()) {
+      auto time_c = std::chrono::system_clock::to_time_t(info.save_time);
       char timestr[64];
       std::strftime(timestr, 64, "%F %T", std::localtime(&time_c));
-      std::string menu_text = conf.name + " (" + timestr + ")";
+      prev_config_items.push_back(PrevConfigItem{
+          .mw = this,
+          .text = info.name + " (" + timestr + ")",
+          .save_time = info.save_time,
+      });
+    }
 
-      auto item =
-          new LogMenuData{.mw = this, .text = menu_text, .config = conf};
-      prev_config_menu_items.push_back({item->text.c_str(), 0,
-                                        select_prev_config_callback, item, 0,
+    /* The menu points into prev_config_items, which is now complete */
+    m_file_loadconfig->flags = FL_SUBMENU;
+    prev_config_menu_items.clear();
+    for (auto &item : prev_config_items) {
+      prev_config_menu_items.push_back({item.text.c_str(), 0,
+                                        select_prev_config_callback, &item, 0,
                                         FL_NORMAL_LABEL, 0, 14, 0});
     }
     prev_config_menu_items.push_back({0, 0, 0, 0, 0, 0, 0, 0, 0});
@@ -357,21 +405,24 @@ void MainWindow::sensor_value_changed_callback(Fl_Widget *w, void *ptr) {
   sensor.const_value = mw->m_sensor_const->value();
 
   mw->m_model->set_value(mw->detail_path, sensor);
-  auto item = get_config_tree_widget(mw->m_config_tree, mw->detail_path);
-  item->dirty(true);
+  mw->rolled_back_paths.erase(mw->detail_path);
+  auto item = mw->config_widget(mw->detail_path);
+  if (item) {
+    item->dirty(true);
+  }
 }
 
 void MainWindow::update_sensor_editor(viaems::SensorValue s) {
-  auto sensor_type = m_model->configuration().types.at("sensor");
+  auto sensor_type = m_model->configuration().types.at("sensor").root();
 
   m_sensor_method->clear();
-  for (auto choice : sensor_type.map()["method"].leaf().choices) {
+  for (const auto &choice : sensor_type.find("method")->leaf().choices) {
     m_sensor_method->add(choice.c_str());
   }
   m_sensor_method->value(m_sensor_method->find_index(s.method.c_str()));
 
   m_sensor_source->clear();
-  for (auto choice : sensor_type.map()["source"].leaf().choices) {
+  for (const auto &choice : sensor_type.find("source")->leaf().choices) {
     m_sensor_source->add(choice.c_str());
   }
   m_sensor_source->value(m_sensor_source->find_index(s.source.c_str()));
@@ -443,11 +494,15 @@ void MainWindow::select_sensor(Fl_Widget *w, void *p) {
   auto mw = (MainWindow *)p;
   auto s = (SelectableTreeWidget *)w;
 
-  auto value = mw->m_model->configuration().get(s->path);
+  auto value = mw->m_model->configuration().find(s->id);
+  mw->detail_path = s->path;
   if (value) {
     mw->m_sensor_editor_box->take_focus();
-    mw->update_sensor_editor(std::get<viaems::SensorValue>(value.value()));
-    mw->detail_path = s->path;
+    mw->update_sensor_editor(std::get<viaems::SensorValue>(*value));
+  } else {
+    /* Shown by update_config_value once it arrives */
+    mw->hide_editors();
+    mw->m_model->prioritize(s->path);
   }
   const auto &name = std::get<std::string>(s->path[s->path.size() - 1]);
   mw->m_sensor_editor_box->label(name.c_str());
@@ -457,24 +512,18 @@ void MainWindow::output_value_changed_callback(MainWindow *mw, int index,
                                                viaems::OutputValue v) {
   viaems::StructurePath path = {"outputs", index};
   mw->m_model->set_value(path, v);
-  auto item = get_config_tree_widget(mw->m_config_tree, {"outputs"});
+  mw->rolled_back_paths.erase({"outputs"});
+  auto item = mw->config_widget({"outputs"});
   item->dirty(true);
 }
 
 static std::vector<viaems::OutputValue> get_model_outputs(viaems::Model *m) {
-  viaems::StructurePath basepath = {"outputs"};
+  const auto &config = m->configuration();
   std::vector<viaems::OutputValue> values;
-  int index = 0;
-  while (true) {
-    auto thispath = basepath;
-    thispath.push_back({index});
-    auto value = m->configuration().get(thispath);
-    if (value) {
-      values.push_back(std::get<viaems::OutputValue>(value.value()));
-    } else {
-      break;
-    }
-    index += 1;
+  viaems::StructurePath path = {"outputs", 0};
+  while (auto value = config.find(path)) {
+    values.push_back(std::get<viaems::OutputValue>(*value));
+    path.back() = (int)values.size();
   }
   return values;
 }
@@ -485,6 +534,7 @@ void MainWindow::select_output(Fl_Widget *w, void *p) {
   auto values = get_model_outputs(mw->m_model);
   mw->m_output_editor->set_outputs(values);
   mw->detail_path = {"outputs"};
+  mw->m_model->prioritize({"outputs"});
 
   mw->m_table_editor_box->hide();
   mw->m_sensor_editor_box->hide();
@@ -495,11 +545,15 @@ void MainWindow::select_table(Fl_Widget *w, void *p) {
   auto mw = (MainWindow *)p;
   auto s = (SelectableTreeWidget *)w;
 
-  auto value = mw->m_model->configuration().get(s->path);
+  auto value = mw->m_model->configuration().find(s->id);
+  mw->detail_path = s->path;
   if (value) {
     mw->m_table_editor->take_focus();
-    mw->update_table_editor(std::get<viaems::TableValue>(value.value()));
-    mw->detail_path = s->path;
+    mw->update_table_editor(std::get<viaems::TableValue>(*value));
+  } else {
+    /* Shown by update_config_value once it arrives */
+    mw->hide_editors();
+    mw->m_model->prioritize(s->path);
   }
   const auto &name = std::get<std::string>(s->path[s->path.size() - 1]);
   mw->m_table_editor_box->label(name.c_str());
@@ -511,21 +565,26 @@ void MainWindow::table_value_changed_callback(Fl_Widget *w, void *ptr) {
   table.title = mw->m_table_title->value();
   table.resize(mw->m_table_rows->value(), mw->m_table_cols->value());
 
-  mw->m_model->set_value(mw->detail_path, table);
+  /* Cell edits only need the cells written, anything else is the whole
+   * table */
+  if (w == mw->m_table_editor_box) {
+    mw->m_model->set_table_cells(mw->detail_path, table,
+                                 mw->m_table_editor->lastChanges());
+  } else {
+    mw->m_model->set_value(mw->detail_path, table);
+  }
 
-  auto item = get_config_tree_widget(mw->m_config_tree, mw->detail_path);
-  item->dirty(true);
+  mw->rolled_back_paths.erase(mw->detail_path);
+  auto item = mw->config_widget(mw->detail_path);
+  if (item) {
+    item->dirty(true);
+  }
 }
 
 void MainWindow::update_table_editor(viaems::TableValue val) {
   m_table_title->value(val.title.c_str());
-  if (val.axis.size() == 1) {
-    m_table_rows->value(val.one.size());
-    m_table_cols->value(1);
-  } else {
-    m_table_rows->value(val.two.size());
-    m_table_cols->value(val.two[0].size());
-  }
+  m_table_rows->value(val.rows);
+  m_table_cols->value(val.cols);
   m_table_editor->setTable(val);
 
   m_table_editor_box->show();
@@ -533,41 +592,102 @@ void MainWindow::update_table_editor(viaems::TableValue val) {
   m_output_editor_box->hide();
 }
 
+void MainWindow::hide_editors() {
+  m_table_editor_box->hide();
+  m_sensor_editor_box->hide();
+  m_output_editor_box->hide();
+}
+
+void MainWindow::config_tree_callback(Fl_Widget *w, void *p) {
+  auto mw = static_cast<MainWindow *>(p);
+  auto item = mw->m_config_tree->callback_item();
+  auto reason = mw->m_config_tree->callback_reason();
+  if (reason == FL_TREE_REASON_CLOSED) {
+    mw->collapse_config_item(item);
+    return;
+  }
+  if (reason != FL_TREE_REASON_OPENED) {
+    return;
+  }
+  mw->expand_config_item(item);
+
+  /* Whatever was just revealed is wanted before the rest */
+  for (int i = 0; i < item->children(); i++) {
+    auto child = dynamic_cast<SelectableTreeWidget *>(item->child(i)->widget());
+    if (child) {
+      mw->m_model->prioritize(child->path);
+    }
+  }
+}
+
 void MainWindow::structure_value_update_callback(Fl_Widget *w, void *p) {
   auto c = dynamic_cast<SelectableTreeWidget *>(w);
   auto m = static_cast<MainWindow *>(p);
   auto val = c->get_value();
   m->m_model->set_value(c->path, val);
+  m->rolled_back_paths.erase(c->path);
+}
+
+/* Items for the children of a node are only built while it is open, so the
+ * tree holds widgets for what can be seen rather than the whole config. A
+ * closed item keeps the handle of its node and an empty placeholder child,
+ * which gives it an open button */
+void MainWindow::defer_config_item(Fl_Tree_Item *item,
+                                   viaems::StructureNode node) {
+  item->user_data((void *)(uintptr_t)node.handle());
+  item->close();
+  auto placeholder = new Fl_Tree_Item(m_config_tree);
+  item->add(m_config_tree->prefs(), "", placeholder);
+}
+
+void MainWindow::expand_config_item(Fl_Tree_Item *item) {
+  if (item->user_data() == nullptr) {
+    return;
+  }
+  auto handle = (viaems::NodeHandle)(uintptr_t)item->user_data();
+  forget_config_widgets(item);
+  item->clear_children();
+
+  m_config_tree->begin();
+  add_config_structure_entry(
+      item, m_model->configuration().structure.node(handle));
+  m_config_tree->end();
+}
+
+void MainWindow::collapse_config_item(Fl_Tree_Item *item) {
+  if (item->user_data() == nullptr) {
+    return;
+  }
+  auto handle = (viaems::NodeHandle)(uintptr_t)item->user_data();
+  forget_config_widgets(item);
+  item->clear_children();
+  defer_config_item(item, m_model->configuration().structure.node(handle));
 }
 
 void MainWindow::add_config_structure_entry(Fl_Tree_Item *parent,
                                             viaems::StructureNode node) {
   if (node.is_map()) {
-    for (auto child : node.map()) {
+    for (auto child : node) {
       auto item = new Fl_Tree_Item(m_config_tree);
-      item->label(child.first.c_str());
+      item->label(child.name().c_str());
       parent->add(m_config_tree->prefs(), "", item);
-      if (child.second.is_leaf()) {
-        auto leaf = child.second.leaf();
-        auto value =
-            m_model->configuration().get(leaf.path).value_or(uint32_t{0});
+      if (child.is_leaf()) {
+        const auto &leaf = child.leaf();
+        auto value = m_model->configuration().find(leaf.id);
         SelectableTreeWidget *w;
+        bool editable = true;
 
         if (leaf.type == "uint32") {
           w = new NumericTreeWidget<uint32_t>(0, 0, 300, 18, leaf.path);
-          w->update_value(value);
           w->callback(structure_value_update_callback, this);
         } else if (leaf.type == "float") {
           w = new NumericTreeWidget<float>(0, 0, 300, 18, leaf.path);
-          w->update_value(value);
           w->callback(structure_value_update_callback, this);
         } else if (leaf.type == "bool") {
           w = new BooleanTreeWidget(0, 0, 300, 18, leaf.path);
-          w->update_value(value);
           w->callback(structure_value_update_callback, this);
         } else if (leaf.type == "string") {
           w = new ChoiceTreeWidget(0, 0, 300, 18, leaf.path, leaf.choices);
-          w->update_value(value);
           w->callback(structure_value_update_callback, this);
         } else if (leaf.type == "table" || leaf.type == "table1d" ||
                    leaf.type == "table2d") {
@@ -578,24 +698,35 @@ void MainWindow::add_config_structure_entry(Fl_Tree_Item *parent,
           w->select_callback(select_sensor, this);
         } else {
           w = new SelectableTreeWidget(0, 0, 300, 18, leaf.path);
+          editable = false;
         }
-        item->widget(w);
+
+        /* A value still being interrogated can't be edited until it is
+         * known; update_config_value fills it in */
+        w->id = leaf.id;
+        if (value) {
+          w->update_value(*value);
+        } else if (editable) {
+          w->deactivate();
+        }
+        index_config_widget(item, w);
       } else {
-        add_config_structure_entry(item, child.second);
+        defer_config_item(item, child);
       }
     }
   } else if (node.is_list()) {
     int index = 0;
-    for (auto child : node.list()) {
+    for (auto child : node) {
       auto item = new Fl_Tree_Item(m_config_tree);
       item->label(std::to_string(index).c_str());
       parent->add(m_config_tree->prefs(), "", item);
       if (child.is_leaf()) {
-        auto leaf = child.leaf();
+        const auto &leaf = child.leaf();
         auto w = new SelectableTreeWidget(0, 0, 300, 18, leaf.path);
-        item->widget(w);
+        w->id = leaf.id;
+        index_config_widget(item, w);
       } else {
-        add_config_structure_entry(item, child);
+        defer_config_item(item, child);
       }
       index += 1;
     }
@@ -605,22 +736,23 @@ void MainWindow::add_config_structure_entry(Fl_Tree_Item *parent,
 void MainWindow::update_config_structure(viaems::StructureNode top) {
   m_config_tree->showroot(0);
   m_config_tree->selectmode(FL_TREE_SELECT_NONE);
+  m_config_tree->callback(config_tree_callback, this);
   auto root = m_config_tree->root();
   if (!top.is_map()) {
     return;
   }
   m_config_tree->begin();
-  for (auto child : top.map()) {
+  for (auto child : top) {
     auto item = new Fl_Tree_Item(m_config_tree);
-    item->label(child.first.c_str());
+    item->label(child.name().c_str());
     root->add(m_config_tree->prefs(), "", item);
-    if (child.first == "outputs") {
+    if (child.name() == "outputs") {
       /* Special handling for outputs, present the list as a single item */
       auto w = new SelectableTreeWidget(0, 0, 300, 18, {"outputs"});
       w->select_callback(select_output, this);
-      item->widget(w);
-    } else {
-      add_config_structure_entry(item, child.second);
+      index_config_widget(item, w);
+    } else if (!child.is_leaf()) {
+      defer_config_item(item, child);
     }
   }
   m_config_tree->end();
@@ -628,6 +760,18 @@ void MainWindow::update_config_structure(viaems::StructureNode top) {
 }
 
 void MainWindow::update_interrogation(bool in_progress, int val, int max) {
+  m_interrogation_progress->label("Interrogation");
+  m_interrogation_progress->maximum(max);
+  m_interrogation_progress->value(val);
+  if (in_progress) {
+    m_interrogation_progress->show();
+  } else {
+    m_interrogation_progress->hide();
+  }
+}
+
+void MainWindow::update_upload(bool in_progress, int val, int max) {
+  m_interrogation_progress->label("Uploading");
   m_interrogation_progress->maximum(max);
   m_interrogation_progress->value(val);
   if (in_progress) {
@@ -638,10 +782,23 @@ void MainWindow::update_interrogation(bool in_progress, int val, int max) {
 }
 
 void MainWindow::update_model(viaems::Model *model) {
+  forget_config_widgets(m_config_tree->root());
   m_config_tree->clear_children(m_config_tree->root());
+  rolled_back_paths.clear();
 
   m_model = model;
-  update_config_structure(model->configuration().structure);
+  update_config_structure(model->configuration().structure.root());
+}
+
+void MainWindow::show_config_rollback(viaems::StructurePath path) {
+  if (std::get<std::string>(path.at(0)) == "outputs") {
+    path = {"outputs"};
+  }
+  rolled_back_paths.insert(path);
+  auto w = config_widget(path);
+  if (w) {
+    w->rolled_back();
+  }
 }
 
 void MainWindow::update_config_value(viaems::StructurePath path,
@@ -650,12 +807,14 @@ void MainWindow::update_config_value(viaems::StructurePath path,
     path = {"outputs"};
   }
 
-  auto w = get_config_tree_widget(m_config_tree, path);
+  auto w = config_widget(path);
   if (w == nullptr) {
     return;
   }
 
   w->update_value(value);
+  w->activate();
+  mark_config_widget(w);
 
   if (path == detail_path) {
     if (std::holds_alternative<viaems::TableValue>(value)) {
@@ -5,22 +5,47 @@
 #include "MainWindowUI.h"
 #include "viaems.h"
 
+class SelectableTreeWidget;
+
 class MainWindow : public MainWindowUI {
   viaems::Model *m_model;
   viaems::StructurePath detail_path;
   std::optional<std::shared_ptr<Log>> log;
   bool logview_paused = false;
 
+  /* Entries of the previous configs menu, which point at these */
+  struct PrevConfigItem {
+    MainWindow *mw;
+    std::string text;
+    std::chrono::system_clock::time_point save_time;
+  };
+  std::vector<PrevConfigItem> prev_config_items;
   std::vector<Fl_Menu_Item> prev_config_menu_items;
   std::function<void(viaems::Configuration)> load_config_callback;
 
+  /* Widgets of the config tree, indexed by the id of their path */
+  viaems::PathInterner config_widget_paths;
+  std::vector<SelectableTreeWidget *> config_widgets;
+  SelectableTreeWidget *config_widget(const viaems::StructurePath &path);
+  void index_config_widget(Fl_Tree_Item *item, SelectableTreeWidget *w);
+  /* Paths shown as rolled back until their next edit. Widgets come and go
+   * with their tree nodes, so their markers are kept here and in the model */
+  std::set<viaems::StructurePath> rolled_back_paths;
+  void mark_config_widget(SelectableTreeWidget *w);
+  void forget_config_widgets(Fl_Tree_Item *item);
+  void defer_config_item(Fl_Tree_Item *item, viaems::StructureNode node);
+  void expand_config_item(Fl_Tree_Item *item);
+  void collapse_config_item(Fl_Tree_Item *item);
+
   void update_config_structure(viaems::StructureNode top);
   void update_table_editor(viaems::TableValue t);
   void update_sensor_editor(viaems::SensorValue s);
+  void hide_editors();
 
   static void select_output(Fl_Widget *w, void *p);
   static void select_table(Fl_Widget *w, void *p);
   static void select_sensor(Fl_Widget *w, void *p);
+  static void config_tree_callback(Fl_Widget *w, void *p);
   static void structure_value_update_callback(Fl_Widget *w, void *p);
   static void table_value_changed_callback(Fl_Widget *w, void *ptr);
   static void sensor_value_changed_callback(Fl_Widget *w, void *ptr);
@@ -37,8 +62,10 @@ public:
   void update_feed_hz(int hz);
   void update_model(viaems::Model *model);
   void update_interrogation(bool in_progress, int value, int max);
+  void update_upload(bool in_progress, int value, int max);
   void update_config_value(viaems::StructurePath path,
                            viaems::ConfigValue value);
+  void show_config_rollback(viaems::StructurePath path);
   void update_log(std::optional<std::shared_ptr<Log>>);
 
   void set_load_config_callback(std::function<void(viaems::Configuration)> cb) {
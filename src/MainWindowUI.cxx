@@ -9,6 +9,10 @@ Fl_Menu_Item MainWindowUI::menu_m_bar[] = {
  {"Export Config", 0,  0, 0, 0, (uchar)FL_NORMAL_LABEL, 0, 14, 0},
  {"Import Config", 0,  0, 0, 0, (uchar)FL_NORMAL_LABEL, 0, 14, 0},
  {0,0,0,0,0,0,0,0,0},
+ {"Edit", 0,  0, 0, 64, (uchar)FL_NORMAL_LABEL, 0, 14, 0},
+ {"Undo", 0x4007a,  0, 0, 0, (uchar)FL_NORMAL_LABEL, 0, 14, 0},
+ {"Redo", 0x5007a,  0, 0, 0, (uchar)FL_NORMAL_LABEL, 0, 14, 0},
+ {0,0,0,0,0,0,0,0,0},
  {"Target", 0,  0, 0, 64, (uchar)FL_NORMAL_LABEL, 0, 14, 0},
  {"Flash", 0,  0, 0, 0, (uchar)FL_NORMAL_LABEL, 0, 14, 0},
  {"Reset to bootloader", 0,  0, 0, 0, (uchar)FL_NORMAL_LABEL, 0, 14, 0},
@@ -17,6 +21,8 @@ Fl_Menu_Item MainWindowUI::menu_m_bar[] = {
  {"Device", 0,  0, 0, 0, (uchar)FL_NORMAL_LABEL, 0, 14, 0},
  {"Simulator", 0,  0, 0, 0, (uchar)FL_NORMAL_LABEL, 0, 14, 0},
  {"Offline", 0,  0, 0, 0, (uchar)FL_NORMAL_LABEL, 0, 14, 0},
+ {"Protocol Trace", 0,  0, 0, 0, (uchar)FL_NORMAL_LABEL, 0, 14, 0},
+ {"Diagnostics", 0,  0, 0, 0, (uchar)FL_NORMAL_LABEL, 0, 14, 0},
  {0,0,0,0,0,0,0,0,0},
  {0,0,0,0,0,0,0,0,0}
 };
@@ -25,13 +31,18 @@ Fl_Menu_Item* MainWindowUI::m_file_open = MainWindowUI::menu_m_bar + 1;
 Fl_Menu_Item* MainWindowUI::m_file_loadconfig = MainWindowUI::menu_m_bar + 2;
 Fl_Menu_Item* MainWindowUI::m_file_export = MainWindowUI::menu_m_bar + 3;
 Fl_Menu_Item* MainWindowUI::m_file_import = MainWindowUI::menu_m_bar + 4;
-Fl_Menu_Item* MainWindowUI::m_target_menu = MainWindowUI::menu_m_bar + 6;
-Fl_Menu_Item* MainWindowUI::m_target_flash = MainWindowUI::menu_m_bar + 7;
-Fl_Menu_Item* MainWindowUI::m_target_bootloader = MainWindowUI::menu_m_bar + 8;
-Fl_Menu_Item* MainWindowUI::m_connection_menu = MainWindowUI::menu_m_bar + 10;
-Fl_Menu_Item* MainWindowUI::m_connection_device = MainWindowUI::menu_m_bar + 11;
-Fl_Menu_Item* MainWindowUI::m_connection_simulator = MainWindowUI::menu_m_bar + 12;
-Fl_Menu_Item* MainWindowUI::m_connection_offline = MainWindowUI::menu_m_bar + 13;
+Fl_Menu_Item* MainWindowUI::m_edit_menu = MainWindowUI::menu_m_bar + 6;
+Fl_Menu_Item* MainWindowUI::m_edit_undo = MainWindowUI::menu_m_bar + 7;
+Fl_Menu_Item* MainWindowUI::m_edit_redo = MainWindowUI::menu_m_bar + 8;
+Fl_Menu_Item* MainWindowUI::m_target_menu = MainWindowUI::menu_m_bar + 10;
+Fl_Menu_Item* MainWindowUI::m_target_flash = MainWindowUI::menu_m_bar + 11;
+Fl_Menu_Item* MainWindowUI::m_target_bootloader = MainWindowUI::menu_m_bar + 12;
+Fl_Menu_Item* MainWindowUI::m_connection_menu = MainWindowUI::menu_m_bar + 14;
+Fl_Menu_Item* MainWindowUI::m_connection_device = MainWindowUI::menu_m_bar + 15;
+Fl_Menu_Item* MainWindowUI::m_connection_simulator = MainWindowUI::menu_m_bar + 16;
+Fl_Menu_Item* MainWindowUI::m_connection_offline = MainWindowUI::menu_m_bar + 17;
+Fl_Menu_Item* MainWindowUI::m_connection_trace = MainWindowUI::menu_m_bar + 18;
+Fl_Menu_Item* MainWindowUI::m_connection_diagnostics = MainWindowUI::menu_m_bar + 19;
 
 MainWindowUI::MainWindowUI() {
   { m_main_window = new Fl_Double_Window(1020, 750, "FLviaems");
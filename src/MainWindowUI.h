@@ -71,6 +71,11 @@ protected:
 public:
   static Fl_Menu_Item *m_file_export;
   static Fl_Menu_Item *m_file_import;
+protected:
+  static Fl_Menu_Item *m_edit_menu;
+public:
+  static Fl_Menu_Item *m_edit_undo;
+  static Fl_Menu_Item *m_edit_redo;
 protected:
   static Fl_Menu_Item *m_target_menu;
 public:
@@ -82,6 +87,8 @@ public:
   static Fl_Menu_Item *m_connection_device;
   static Fl_Menu_Item *m_connection_simulator;
   static Fl_Menu_Item *m_connection_offline;
+  static Fl_Menu_Item *m_connection_trace;
+  static Fl_Menu_Item *m_connection_diagnostics;
 protected:
   Fl_Output *m_status_text;
   LogView *m_logview;
@@ -0,0 +1,129 @@
+#include <algorithm>
+#include <cstdio>
+
+#include "Metrics.h"
+
+size_t Histogram::index_of(uint64_t value) {
+  if (value < sub_buckets) {
+    return value;
+  }
+  int msb = 63 - __builtin_clzll(value);
+  int shift = msb - sub_bucket_bits;
+  uint64_t sub = (value >> shift) - sub_buckets;
+  return sub_buckets * (shift + 1) + sub;
+}
+
+uint64_t Histogram::highest_equivalent(size_t index) {
+  if (index < sub_buckets) {
+    return index;
+  }
+  int shift = index / sub_buckets - 1;
+  uint64_t sub = index % sub_buckets + sub_buckets;
+  return ((sub + 1) << shift) - 1;
+}
+
+void Histogram::Record(uint64_t value) {
+  counts[index_of(value)] += 1;
+  count += 1;
+  sum += value;
+  min = std::min(min, value);
+  max = std::max(max, value);
+}
+
+void Histogram::Merge(const Histogram &other) {
+  for (size_t i = 0; i < n_buckets; i++) {
+    counts[i] += other.counts[i];
+  }
+  count += other.count;
+  sum += other.sum;
+  min = std::min(min, other.min);
+  max = std::max(max, other.max);
+}
+
+uint64_t Histogram::Percentile(double p) const {
+  if (count == 0) {
+    return 0;
+  }
+  uint64_t target = (uint64_t)(p / 100.0 * count + 0.5);
+  target = std::max(target, (uint64_t)1);
+
+  uint64_t seen = 0;
+  for (size_t i = 0; i < n_buckets; i++) {
+    seen += counts[i];
+    if (seen >= target) {
+      return std::min(highest_equivalent(i), max);
+    }
+  }
+  return max;
+}
+
+static std::string format_histogram(const std::string &name,
+                                    const Histogram &h) {
+  char line[160];
+  snprintf(line, sizeof(line),
+           "  %-16s %8lu %8lu %8lu %8lu %8lu %8lu %10.1f\n", name.c_str(),
+           (unsigned long)h.Count(), (unsigned long)h.Min(),
+           (unsigned long)h.Percentile(50), (unsigned long)h.Percentile(90),
+           (unsigned long)h.Percentile(99), (unsigned long)h.Max(), h.Mean());
+  return line;
+}
+
+static std::string format_counter(const std::string &name, uint64_t value) {
+  char line[80];
+  snprintf(line, sizeof(line), "  %-24s %10lu\n", name.c_str(),
+           (unsigned long)value);
+  return line;
+}
+
+std::string format_metrics(const ProtocolMetrics &m) {
+  char header[160];
+  snprintf(header, sizeof(header), "  %-16s %8s %8s %8s %8s %8s %8s %10s\n",
+           "", "count", "min", "p50", "p90", "p99", "max", "mean");
+
+  std::string out;
+  out += "Request round trip (us)\n";
+  out += header;
+  for (const auto &[method, h] : m.request_rtt_us) {
+    out += format_histogram(method, h);
+  }
+
+  out += "\nRequest queue wait (us)\n";
+  out += header;
+  const char *priorities[] = {"control", "interactive", "background"};
+  for (size_t i = 0; i < m.request_wait_us.size(); i++) {
+    out += format_histogram(priorities[i], m.request_wait_us[i]);
+  }
+
+  out += "\nQueues and feed\n";
+  out += header;
+  out += format_histogram("pending depth", m.pending_depth);
+  out += format_histogram("feed fps", m.feed_fps);
+  out += format_histogram("feed decode ns", m.feed_decode_ns);
+
+  char fps[80];
+  snprintf(fps, sizeof(fps), "  %-24s %10.1f\n", "current feed fps",
+           m.feed_fps_current);
+  char interval[80];
+  snprintf(interval, sizeof(interval), "  %-24s %10.1f\n", "feed interval us",
+           m.feed_interval_us);
+
+  out += "\nCounters\n";
+  out += fps;
+  out += interval;
+  out += format_counter("feed gaps", m.feed_gaps);
+  out += format_counter("lost feed samples", m.lost_feed_samples);
+  out += format_counter("requests sent", m.requests_sent);
+  out += format_counter("responses", m.responses);
+  out += format_counter("unmatched responses", m.unmatched_responses);
+  out += format_counter("cancelled requests", m.cancelled_requests);
+  out += format_counter("retried requests", m.retried_requests);
+  out += format_counter("timed out requests", m.timed_out_requests);
+  out += format_counter("feed frames", m.feed_frames);
+  out += format_counter("dropped feed frames", m.dropped_feed_frames);
+  out += format_counter("malformed messages", m.malformed_messages);
+  out += format_counter("connection frames", m.connection.frames);
+  out += format_counter("malformed frames", m.connection.malformed_frames);
+  out += format_counter("reader queue high water",
+                        m.connection.queue_high_water);
+  return out;
+}
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <string>
+
+/* Log-linear histogram in the style of HdrHistogram. Each power of two range
+ * is split into 32 linear sub-buckets, so any recorded value is reported to
+ * within about 3%, over the full 64 bit range, in fixed memory and with
+ * constant time recording */
+class Histogram {
+  static const int sub_bucket_bits = 5;
+  static const uint64_t sub_buckets = 1 << sub_bucket_bits;
+  static const size_t n_buckets = sub_buckets * (64 - sub_bucket_bits + 1);
+
+  std::array<uint64_t, n_buckets> counts{};
+  uint64_t count = 0;
+  uint64_t min = UINT64_MAX;
+  uint64_t max = 0;
+  double sum = 0;
+
+  static size_t index_of(uint64_t value);
+  static uint64_t highest_equivalent(size_t index);
+
+public:
+  void Record(uint64_t value);
+  void Merge(const Histogram &other);
+  void Reset() { *this = Histogram{}; }
+
+  uint64_t Count() const { return count; }
+  uint64_t Min() const { return count ? min : 0; }
+  uint64_t Max() const { return max; }
+  double Mean() const { return count ? sum / count : 0; }
+
+  /* Smallest recorded value (to histogram precision) that at least p percent
+   * of the recorded values are less than or equal to */
+  uint64_t Percentile(double p) const;
+};
+
+/* Reported by a connection about its own reader */
+struct ConnectionStats {
+  uint64_t frames = 0;
+  uint64_t malformed_frames = 0;
+
+  /* Largest number of decoded messages waiting to be read */
+  uint64_t queue_high_water = 0;
+};
+
+struct ProtocolMetrics {
+  /* Request round trip, from being written until its response is handled,
+   * in microseconds, by method. Includes ping */
+  std::map<std::string, Histogram> request_rtt_us;
+
+  /* Time spent queued before being sent, in microseconds, indexed by
+   * request priority (control, interactive, background) */
+  std::array<Histogram, 3> request_wait_us;
+
+  /* Number of requests outstanding, sampled as each is queued */
+  Histogram pending_depth;
+
+  /* Feed frames received per second, sampled once a second */
+  Histogram feed_fps;
+  double feed_fps_current = 0;
+
+  /* Time taken to turn a received feed frame into a log point */
+  Histogram feed_decode_ns;
+
+  /* Feed cadence learned from cputime, and frames missing from it */
+  double feed_interval_us = 0;
+  uint64_t feed_gaps = 0;
+  uint64_t lost_feed_samples = 0;
+
+  uint64_t requests_sent = 0;
+  uint64_t responses = 0;
+  uint64_t unmatched_responses = 0;
+  uint64_t cancelled_requests = 0;
+  uint64_t retried_requests = 0;
+  uint64_t timed_out_requests = 0;
+  uint64_t feed_frames = 0;
+
+  /* Feed frames that could not be used, such as before a description */
+  uint64_t dropped_feed_frames = 0;
+
+  /* Decoded messages with a missing or unknown type, or missing fields */
+  uint64_t malformed_messages = 0;
+
+  ConnectionStats connection;
+};
+
+/* Multi-line plain text summary, for logs and the diagnostics panel */
+std::string format_metrics(const ProtocolMetrics &m);
@@ -0,0 +1,165 @@
+#include <algorithm>
+#include <iostream>
+
+#include "ReplayConnection.h"
+
+/* When replaying as fast as possible, don't let the playback thread get more
+ * than this many messages ahead of the reader */
+static const size_t max_queued_messages = 4096;
+
+/* A truncated or foreign capture may hold frames without a usable id */
+static bool has_numeric_id(const json &msg) {
+  return msg.contains("id") && msg["id"].is_number_unsigned();
+}
+
+static std::string request_key(const json &req) {
+  std::string key = req.value("method", "");
+  if (req.contains("path")) {
+    key += " " + req["path"].dump();
+  }
+  if (req.contains("value")) {
+    key += " " + req["value"].dump();
+  }
+  return key;
+}
+
+ReplayConnection::ReplayConnection(notify_cb notify, void *ptr,
+                                   std::string path, double speed)
+    : notify{notify}, notify_ptr{ptr}, speed{speed} {
+  index_capture(ReadWireCapture(path));
+
+  done = false;
+  running = true;
+  thread = std::thread([](ReplayConnection *c) { c->playback_loop(); }, this);
+}
+
+ReplayConnection::~ReplayConnection() {
+  std::unique_lock<std::mutex> lock(in_mutex);
+  running = false;
+  in_cv.notify_all();
+  lock.unlock();
+  thread.join();
+}
+
+void ReplayConnection::index_capture(const std::vector<WireFrame> &frames) {
+  /* Pair up each recorded request with the response that carried its id */
+  std::map<uint32_t, std::string> outstanding;
+
+  for (const auto &frame : frames) {
+    auto msg = json::from_cbor(frame.data, true, false);
+    if (msg.is_discarded() || !msg.is_object()) {
+      continue;
+    }
+
+    if (frame.direction == WireDirection::Outbound) {
+      if (has_numeric_id(msg)) {
+        outstanding[msg["id"].get<uint32_t>()] = request_key(msg);
+      }
+    } else if (msg.value("type", "") == "response") {
+      if (!has_numeric_id(msg)) {
+        continue;
+      }
+      auto req = outstanding.find(msg["id"].get<uint32_t>());
+      if (req == outstanding.end()) {
+        continue;
+      }
+      responses[req->second].push_back(msg);
+      outstanding.erase(req);
+    } else {
+      timeline.push_back(frame);
+    }
+  }
+}
+
+void ReplayConnection::push_message(json &&msg) {
+  std::unique_lock<std::mutex> lock(in_mutex);
+  in_messages.push_back(std::move(msg));
+  stats.frames += 1;
+  stats.queue_high_water =
+      std::max(stats.queue_high_water, (uint64_t)in_messages.size());
+  lock.unlock();
+  notify(notify_ptr);
+}
+
+void ReplayConnection::Write(const json &msg) {
+  if (!msg.contains("id")) {
+    /* Flash and bootloader requests have no response */
+    return;
+  }
+
+  json response;
+  auto recorded = responses.find(request_key(msg));
+  if ((recorded != responses.end()) && !recorded->second.empty()) {
+    response = recorded->second.front();
+    /* Keep the last response around to answer repeats of this request */
+    if (recorded->second.size() > 1) {
+      recorded->second.pop_front();
+    }
+  } else {
+    response = json{
+        {"type", "response"},
+        {"response", msg.contains("value") ? msg["value"] : json{}},
+    };
+    if (msg.value("method", "") == "structure") {
+      response["types"] = json::object();
+    }
+  }
+  response["id"] = msg["id"];
+  push_message(std::move(response));
+}
+
+std::optional<json> ReplayConnection::Read() {
+  std::unique_lock<std::mutex> lock(in_mutex);
+  if (in_messages.empty()) {
+    return {};
+  }
+  auto msg = std::move(in_messages.front());
+  in_messages.pop_front();
+  in_cv.notify_all();
+  return msg;
+}
+
+ConnectionStats ReplayConnection::Stats() {
+  std::unique_lock<std::mutex> lock(in_mutex);
+  return stats;
+}
+
+bool ReplayConnection::Finished() {
+  std::unique_lock<std::mutex> lock(in_mutex);
+  return done && in_messages.empty();
+}
+
+void ReplayConnection::playback_loop() {
+  auto start = std::chrono::steady_clock::now();
+  uint64_t first_ns = timeline.empty() ? 0 : timeline.front().time_ns;
+
+  for (const auto &frame : timeline) {
+    std::unique_lock<std::mutex> lock(in_mutex);
+    if (speed > 0) {
+      auto offset = std::chrono::nanoseconds{
+          (uint64_t)((frame.time_ns - first_ns) / speed)};
+      in_cv.wait_until(lock, start + offset, [this]() { return !running; });
+    } else {
+      in_cv.wait(lock, [this]() {
+        return !running || (in_messages.size() < max_queued_messages);
+      });
+    }
+    lock.unlock();
+    if (!running) {
+      return;
+    }
+
+    /* Decode here rather than up front so replay exercises the same decode
+     * cost a reader thread sees on a live link */
+    try {
+      push_message(json::from_cbor(frame.data));
+    } catch (json::parse_error &e) {
+      std::cerr << "replay parse_error: " << e.what() << std::endl;
+      std::unique_lock<std::mutex> lock(in_mutex);
+      stats.malformed_frames += 1;
+    }
+  }
+
+  done = true;
+  notify(notify_ptr);
+}
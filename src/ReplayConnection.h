@@ -0,0 +1,54 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <thread>
+
+#include "WireCapture.h"
+#include "viaems.h"
+
+/* Connection that stands in for a target by replaying a wire capture.
+ *
+ * Feed and description messages are played back on their recorded timeline,
+ * scaled by speed (1.0 is real time, 0 replays as fast as the reader keeps
+ * up). Requests written to the connection are answered with the response
+ * recorded for the same request, or a plausible default if the recording
+ * never saw it.
+ */
+class ReplayConnection : public viaems::Connection {
+public:
+  ReplayConnection(notify_cb notify, void *ptr, std::string path,
+                   double speed = 1.0);
+  virtual ~ReplayConnection();
+
+  virtual void Write(const json &msg);
+  virtual std::optional<json> Read();
+  virtual ConnectionStats Stats();
+
+  /* True once every recorded message has been handed to Read() */
+  bool Finished();
+
+private:
+  notify_cb notify;
+  void *notify_ptr;
+  double speed;
+
+  std::vector<WireFrame> timeline;
+  std::map<std::string, std::deque<json>> responses;
+
+  std::thread thread;
+  std::atomic<bool> running;
+  std::atomic<bool> done;
+
+  std::mutex in_mutex;
+  std::condition_variable in_cv;
+  std::deque<json> in_messages;
+  ConnectionStats stats;
+
+  void index_capture(const std::vector<WireFrame> &frames);
+  void push_message(json &&msg);
+  void playback_loop();
+};
@@ -29,6 +29,18 @@ void TableEditor::cell_select_callback(Fl_Widget *w, void *ptr) {
         editor->adjust_selection(1);
       } else if (x == '-') {
         editor->adjust_selection(-1);
+      } else if (x == ']') {
+        editor->edit_selection([](viaems::TableValue &t,
+                                  viaems::TableRegion r) { t.scale(r, 1.01); });
+      } else if (x == '[') {
+        editor->edit_selection([](viaems::TableValue &t,
+                                  viaems::TableRegion r) { t.scale(r, 0.99); });
+      } else if (x == 's') {
+        editor->edit_selection(
+            [](viaems::TableValue &t, viaems::TableRegion r) { t.smooth(r); });
+      } else if (x == 'i') {
+        editor->edit_selection([](viaems::TableValue &t,
+                                  viaems::TableRegion r) { t.interpolate(r); });
       }
       break;
     }
@@ -37,51 +49,50 @@ void TableEditor::cell_select_callback(Fl_Widget *w, void *ptr) {
   }
 }
 
-void TableEditor::adjust_selection(int amt) {
-  int row_top, col_left, row_bot, col_right;
-  this->get_selection(row_top, col_left, row_bot, col_right);
+/* Applies op to the table and the selected region as one edit */
+template <typename Op> void TableEditor::edit_selection(Op op) {
+  viaems::TableRegion region;
+  get_selection(region.top, region.left, region.bottom, region.right);
+  if ((region.top < 0) || (region.left < 0)) {
+    return;
+  }
 
-  if (this->table.axis.size() == 1) {
-    for (int r = row_top; r <= row_bot; r++) {
-      this->edit_changes.insert(std::make_pair(r, 0));
-      this->table.one[r] += amt;
-    }
-  } else {
-    for (int r = row_top; r <= row_bot; r++) {
-      for (int c = col_left; c <= col_right; c++) {
-        this->edit_changes.insert(std::make_pair(r, c));
-        this->table.two[r][c] += amt;
+  /* Only cells the op actually changed count as edited */
+  auto before = table;
+  op(table, region);
+
+  last_changes.clear();
+  for (int r = region.top; r <= region.bottom; r++) {
+    for (int c = region.left; c <= region.right; c++) {
+      if (table.at(r, c) != before.at(r, c)) {
+        edit_changes.insert(std::make_pair(r, c));
+        last_changes.insert(last_changes.end(), std::make_pair(r, c));
       }
     }
   }
-  this->parent()->do_callback();
+  if (last_changes.empty()) {
+    return;
+  }
+  parent()->do_callback();
+}
+
+void TableEditor::adjust_selection(int amt) {
+  edit_selection([amt](viaems::TableValue &t, viaems::TableRegion region) {
+    t.offset(region, amt);
+  });
 }
 
 void TableEditor::cell_value_callback(Fl_Widget *w, void *ptr) {
   auto editor = static_cast<TableEditor *>(ptr);
   float value;
 
-  int row_top, col_left, row_bot, col_right;
-  editor->get_selection(row_top, col_left, row_bot, col_right);
-
   std::istringstream ss{editor->input->value()};
   ss >> value;
 
-  if (editor->table.axis.size() == 1) {
-    for (int r = row_top; r <= row_bot; r++) {
-      editor->edit_changes.insert(std::make_pair(r, 0));
-      editor->table.one[r] = value;
-    }
-  } else {
-    for (int r = row_top; r <= row_bot; r++) {
-      for (int c = col_left; c <= col_right; c++) {
-        editor->edit_changes.insert(std::make_pair(r, c));
-        editor->table.two[r][c] = value;
-      }
-    }
-  }
-
-  editor->parent()->do_callback();
+  editor->edit_selection(
+      [value](viaems::TableValue &t, viaems::TableRegion region) {
+        t.fill(region, value);
+      });
   editor->stop_editor();
 }
 
@@ -134,27 +145,18 @@ TableEditor::TableEditor(int X, int Y, int W, int H) : Fl_Table(X, Y, W, H) {
 
 void TableEditor::setTable(viaems::TableValue t) {
   this->table = t;
-  if (this->table.axis.size() == 1) {
-    rows(this->table.one.size());
-    cols(1);
-    col_header(0);
-  } else {
-    rows(this->table.two.size());
-    cols(this->table.two[0].size());
-    col_header(1);
-  }
+  rows(this->table.rows);
+  cols(this->table.cols);
+  col_header(this->table.axis.size() == 2 ? 1 : 0);
   col_width_all(40);
   row_height_all(25);
   edit_changes.clear();
+  last_changes.clear();
 }
 
 std::string TableEditor::cell_value(int r, int c) {
   char buf[32];
-  if (this->table.axis.size() == 2) {
-    snprintf(buf, sizeof(buf), "%.3g", this->table.two[r][c]);
-  } else {
-    snprintf(buf, sizeof(buf), "%.3g", this->table.one[r]);
-  }
+  snprintf(buf, sizeof(buf), "%.3g", this->table.at(r, c));
   return std::string{buf};
 }
 
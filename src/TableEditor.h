@@ -15,17 +15,22 @@ public:
   void setTable(viaems::TableValue table);
   viaems::TableValue getTable() { return table; };
 
+  /* Cells changed by the most recent edit */
+  const std::set<std::pair<int, int>> &lastChanges() { return last_changes; }
+
 private:
   Fl_Float_Input *input;
   viaems::TableValue table;
 
   int edit_r, edit_c;
   std::set<std::pair<int, int>> edit_changes;
+  std::set<std::pair<int, int>> last_changes;
 
   void draw_cell(TableContext c, int R, int C, int X, int Y, int W, int H);
   std::string cell_value(int r, int c);
 
   void adjust_selection(int amt);
+  template <typename Op> void edit_selection(Op op);
   static void cell_select_callback(Fl_Widget *w, void *);
   static void cell_value_callback(Fl_Widget *w, void *);
   void start_editor(int R, int C);
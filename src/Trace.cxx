@@ -0,0 +1,290 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <iostream>
+#include <sstream>
+
+#include "Trace.h"
+
+static const char *trace_type_names[] = {"feed", "description", "request",
+                                         "response", "other"};
+
+static const uint32_t no_request_id = 0xffffffff;
+
+TraceType trace_type_from_message(const std::string &type) {
+  for (size_t i = 0; i < (size_t)TraceType::Count; i++) {
+    if (type == trace_type_names[i]) {
+      return (TraceType)i;
+    }
+  }
+  return TraceType::Other;
+}
+
+TraceRing::TraceRing(size_t capacity) {
+  size_t size = 1;
+  while (size < capacity) {
+    size <<= 1;
+  }
+  buffer.resize(size);
+  mask = size - 1;
+}
+
+void TraceRing::copy_in(size_t pos, const void *src, size_t len) {
+  auto start = pos & mask;
+  auto first = std::min(len, buffer.size() - start);
+  std::memcpy(&buffer[start], src, first);
+  std::memcpy(&buffer[0], (const uint8_t *)src + first, len - first);
+}
+
+void TraceRing::copy_out(size_t pos, void *dst, size_t len) const {
+  auto start = pos & mask;
+  auto first = std::min(len, buffer.size() - start);
+  std::memcpy(dst, &buffer[start], first);
+  std::memcpy((uint8_t *)dst + first, &buffer[0], len - first);
+}
+
+bool TraceRing::push(const TraceRecordHeader &header,
+                     const uint8_t *payload) {
+  auto h = head.load(std::memory_order_relaxed);
+  auto t = tail.load(std::memory_order_acquire);
+  size_t needed = sizeof(header) + header.length;
+  if (buffer.size() - (h - t) < needed) {
+    return false;
+  }
+  copy_in(h, &header, sizeof(header));
+  copy_in(h + sizeof(header), payload, header.length);
+  head.store(h + needed, std::memory_order_release);
+  return true;
+}
+
+bool TraceRing::pop(TraceRecordHeader &header, std::vector<uint8_t> &payload) {
+  auto t = tail.load(std::memory_order_relaxed);
+  auto h = head.load(std::memory_order_acquire);
+  if (h == t) {
+    return false;
+  }
+  copy_out(t, &header, sizeof(header));
+  payload.resize(header.length);
+  copy_out(t + sizeof(header), payload.data(), header.length);
+  tail.store(t + sizeof(header) + header.length, std::memory_order_release);
+  return true;
+}
+
+void StderrTraceSink::Write(const std::string &line) {
+  std::cerr << line << '\n';
+}
+
+void StderrTraceSink::Flush() { std::cerr.flush(); }
+
+FileTraceSink::FileTraceSink(std::string path, size_t max_file_size,
+                             int max_files)
+    : path{path}, max_file_size{max_file_size}, max_files{max_files} {
+  file.open(path, std::ios::trunc);
+}
+
+void FileTraceSink::rotate() {
+  file.close();
+  for (int i = max_files - 1; i > 0; i--) {
+    auto from = (i == 1) ? path : path + "." + std::to_string(i - 1);
+    auto to = path + "." + std::to_string(i);
+    std::rename(from.c_str(), to.c_str());
+  }
+  file.open(path, std::ios::trunc);
+  file_size = 0;
+}
+
+void FileTraceSink::Write(const std::string &line) {
+  file << line << '\n';
+  file_size += line.size() + 1;
+  /* With a single file, rotating just starts it over */
+  if (file_size >= max_file_size) {
+    rotate();
+  }
+}
+
+void FileTraceSink::Flush() { file.flush(); }
+
+void BufferTraceSink::Write(const std::string &line) {
+  std::unique_lock<std::mutex> lock(mutex);
+  lines.push_back(line);
+  if (lines.size() > max_lines) {
+    lines.pop_front();
+  }
+}
+
+std::deque<std::string> BufferTraceSink::Take() {
+  std::unique_lock<std::mutex> lock(mutex);
+  return std::move(lines);
+}
+
+Tracer::Tracer(size_t ring_size) : ring{ring_size} {
+  for (auto &level : levels) {
+    level = 0;
+  }
+  running = true;
+  thread = std::thread([](Tracer *t) { t->format_loop(); }, this);
+}
+
+Tracer::~Tracer() {
+  running = false;
+  thread.join();
+}
+
+void Tracer::AddSink(std::shared_ptr<TraceSink> sink) {
+  std::unique_lock<std::mutex> lock(sinks_mutex);
+  sinks.push_back(sink);
+}
+
+void Tracer::SetLevel(int level) {
+  for (size_t i = 0; i < (size_t)TraceType::Count; i++) {
+    auto type = (TraceType)i;
+    bool periodic = (type == TraceType::Feed) ||
+                    (type == TraceType::Description);
+    if (level > 1) {
+      SetLevel(type, 2);
+    } else if (level == 1) {
+      SetLevel(type, periodic ? 0 : 2);
+    } else {
+      SetLevel(type, 0);
+    }
+  }
+}
+
+bool Tracer::Configure(const std::string &spec) {
+  if (spec.find('=') == std::string::npos) {
+    SetLevel(atoi(spec.c_str()));
+    return true;
+  }
+
+  std::istringstream ss{spec};
+  std::string item;
+  while (std::getline(ss, item, ',')) {
+    auto eq = item.find('=');
+    if (eq == std::string::npos) {
+      return false;
+    }
+    auto name = item.substr(0, eq);
+    int level = atoi(item.substr(eq + 1).c_str());
+    if (name == "all") {
+      for (size_t i = 0; i < (size_t)TraceType::Count; i++) {
+        SetLevel((TraceType)i, level);
+      }
+      continue;
+    }
+    auto type = trace_type_from_message(name);
+    if ((type == TraceType::Other) && (name != "other")) {
+      return false;
+    }
+    SetLevel(type, level);
+  }
+  return true;
+}
+
+void Tracer::Record(TraceDirection dir, TraceType type, const json &msg) {
+  int level = levels[(size_t)type].load(std::memory_order_relaxed);
+  if (level <= 0) {
+    return;
+  }
+
+  TraceRecordHeader header{};
+  header.time_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                       std::chrono::system_clock::now().time_since_epoch())
+                       .count();
+  header.direction = dir;
+  header.type = type;
+  header.id = no_request_id;
+  auto id = msg.find("id");
+  if ((id != msg.end()) && id->is_number_unsigned()) {
+    header.id = id->get<uint32_t>();
+  }
+
+  std::vector<uint8_t> payload;
+  if (level > 1) {
+    payload = json::to_cbor(msg);
+  }
+  header.length = payload.size();
+
+  if (!ring.push(header, payload.data())) {
+    dropped.fetch_add(1, std::memory_order_relaxed);
+  }
+}
+
+std::string Tracer::format(const TraceRecordHeader &header,
+                           const std::vector<uint8_t> &payload) {
+  auto time = std::chrono::system_clock::time_point{
+      std::chrono::nanoseconds{header.time_ns}};
+  auto time_c = std::chrono::system_clock::to_time_t(time);
+  char timestr[32];
+  std::strftime(timestr, sizeof(timestr), "%T", std::localtime(&time_c));
+  char usstr[16];
+  snprintf(usstr, sizeof(usstr), ".%06lu",
+           (unsigned long)((header.time_ns / 1000) % 1000000));
+
+  std::string line = std::string{timestr} + usstr +
+                     (header.direction == TraceDirection::Recv ? " recv: "
+                                                               : " send: ");
+  if (payload.empty()) {
+    line += trace_type_names[(size_t)header.type];
+    if (header.id != no_request_id) {
+      line += " id=" + std::to_string(header.id);
+    }
+    return line;
+  }
+
+  auto msg = json::from_cbor(payload, true, false);
+  line += msg.is_discarded() ? "<undecodable>" : msg.dump();
+  return line;
+}
+
+void Tracer::format_loop() {
+  TraceRecordHeader header;
+  std::vector<uint8_t> payload;
+  uint64_t reported_dropped = 0;
+
+  while (true) {
+    /* Read running before draining, so that records made before shutdown are
+     * always formatted */
+    bool stopping = !running;
+
+    std::unique_lock<std::mutex> lock(sinks_mutex);
+    bool any = false;
+    while (ring.pop(header, payload)) {
+      auto line = format(header, payload);
+      for (auto &sink : sinks) {
+        sink->Write(line);
+      }
+      any = true;
+    }
+
+    auto total_dropped = dropped.load(std::memory_order_relaxed);
+    if (total_dropped != reported_dropped) {
+      auto line = "trace: dropped " +
+                  std::to_string(total_dropped - reported_dropped) +
+                  " records";
+      for (auto &sink : sinks) {
+        sink->Write(line);
+      }
+      reported_dropped = total_dropped;
+      any = true;
+    }
+
+    if (any) {
+      for (auto &sink : sinks) {
+        sink->Flush();
+      }
+    }
+    lock.unlock();
+
+    if (stopping) {
+      return;
+    }
+    if (!any) {
+      /* The producer never signals, so that recording stays a few stores
+       * into the ring; poll instead */
+      std::this_thread::sleep_for(std::chrono::milliseconds{20});
+    }
+  }
+}
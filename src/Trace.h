@@ -0,0 +1,158 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <nlohmann/json.hpp>
+using json = nlohmann::json;
+
+/* Protocol tracing that stays off the caller's thread.
+ *
+ * Trace events are written as compact binary records (a fixed header plus,
+ * for full traces, the message re-encoded as CBOR) into a lock-free single
+ * producer, single consumer ring. A background thread decodes and formats
+ * them and hands the text to each sink. If the ring is full the event is
+ * dropped and counted rather than blocking the producer.
+ *
+ * Each message type has its own level:
+ *   0  not traced
+ *   1  summary (direction, type and request id)
+ *   2  the full message
+ */
+
+enum class TraceDirection : uint8_t {
+  Recv = 0,
+  Send = 1,
+};
+
+enum class TraceType : uint8_t {
+  Feed = 0,
+  Description,
+  Request,
+  Response,
+  Other,
+  Count,
+};
+
+TraceType trace_type_from_message(const std::string &type);
+
+struct TraceRecordHeader {
+  uint64_t time_ns;
+  uint32_t id;
+  uint32_t length;
+  TraceDirection direction;
+  TraceType type;
+};
+
+class TraceRing {
+  std::vector<uint8_t> buffer;
+  size_t mask;
+  std::atomic<size_t> head{0};
+  std::atomic<size_t> tail{0};
+
+  void copy_in(size_t pos, const void *src, size_t len);
+  void copy_out(size_t pos, void *dst, size_t len) const;
+
+public:
+  /* capacity is rounded up to a power of two */
+  TraceRing(size_t capacity);
+
+  /* Producer side. Returns false if there isn't room for the record */
+  bool push(const TraceRecordHeader &header, const uint8_t *payload);
+
+  /* Consumer side. Returns false if the ring is empty */
+  bool pop(TraceRecordHeader &header, std::vector<uint8_t> &payload);
+};
+
+class TraceSink {
+public:
+  virtual void Write(const std::string &line) = 0;
+  virtual void Flush() {}
+  virtual ~TraceSink() {}
+};
+
+class StderrTraceSink : public TraceSink {
+public:
+  void Write(const std::string &line);
+  void Flush();
+};
+
+class FileTraceSink : public TraceSink {
+  std::string path;
+  size_t max_file_size;
+  int max_files;
+  std::ofstream file;
+  size_t file_size = 0;
+
+  void rotate();
+
+public:
+  FileTraceSink(std::string path, size_t max_file_size = 16 * 1024 * 1024,
+                int max_files = 4);
+  void Write(const std::string &line);
+  void Flush();
+};
+
+/* Keeps the most recent lines for an in-app viewer to collect */
+class BufferTraceSink : public TraceSink {
+  std::mutex mutex;
+  std::deque<std::string> lines;
+  size_t max_lines;
+
+public:
+  BufferTraceSink(size_t max_lines = 5000) : max_lines{max_lines} {}
+  void Write(const std::string &line);
+
+  /* Return and forget every line written since the last call */
+  std::deque<std::string> Take();
+};
+
+class Tracer {
+  TraceRing ring;
+  std::array<std::atomic<int>, (size_t)TraceType::Count> levels;
+  std::atomic<uint64_t> dropped{0};
+
+  std::mutex sinks_mutex;
+  std::vector<std::shared_ptr<TraceSink>> sinks;
+
+  std::thread thread;
+  std::atomic<bool> running;
+
+  void format_loop();
+  std::string format(const TraceRecordHeader &header,
+                     const std::vector<uint8_t> &payload);
+
+public:
+  Tracer(size_t ring_size = 1024 * 1024);
+  Tracer(const Tracer &) = delete;
+  Tracer &operator=(const Tracer &) = delete;
+  ~Tracer();
+
+  void AddSink(std::shared_ptr<TraceSink> sink);
+
+  /* Compatibility levels: 1 traces everything but feed and description
+   * messages in full, 2 traces everything in full */
+  void SetLevel(int level);
+  void SetLevel(TraceType type, int level) {
+    levels[(size_t)type].store(level, std::memory_order_relaxed);
+  }
+
+  /* Apply either a single compatibility level ("1") or a comma separated
+   * list of per-type levels ("feed=1,response=2") */
+  bool Configure(const std::string &spec);
+
+  bool Enabled(TraceType type) const {
+    return levels[(size_t)type].load(std::memory_order_relaxed) > 0;
+  }
+
+  /* Must only be called from one thread, the one driving the Protocol */
+  void Record(TraceDirection dir, TraceType type, const json &msg);
+};
@@ -0,0 +1,84 @@
+#include "TraceView.h"
+
+#include <iostream>
+
+TraceViewWindow::TraceViewWindow(int X, int Y, int W, int H)
+    : Fl_Double_Window(X, Y, W, H, "Protocol Trace") {
+  levels = new Fl_Input(60, 5, W - 140, 25, "Levels");
+  levels->tooltip("A level (0, 1 or 2) or per-type levels, such as "
+                  "\"feed=1,request=2,response=2\"");
+  levels->when(FL_WHEN_ENTER_KEY);
+  levels->callback(levels_changed, this);
+
+  clear = new Fl_Button(W - 75, 5, 70, 25, "Clear");
+  clear->callback(clear_pressed, this);
+
+  buffer = new Fl_Text_Buffer();
+  display = new Fl_Text_Display(0, 35, W, H - 35);
+  display->buffer(buffer);
+  display->textfont(FL_COURIER);
+  display->textsize(12);
+  resizable(display);
+  end();
+
+  Fl::add_timeout(0.25, refresh, this);
+}
+
+TraceViewWindow::~TraceViewWindow() {
+  Fl::remove_timeout(refresh, this);
+  display->buffer(nullptr);
+  delete buffer;
+}
+
+void TraceViewWindow::set_tracer(std::shared_ptr<Tracer> tracer,
+                                 std::shared_ptr<BufferTraceSink> sink) {
+  this->tracer = tracer;
+  this->sink = sink;
+}
+
+void TraceViewWindow::refresh(void *ptr) {
+  auto tv = static_cast<TraceViewWindow *>(ptr);
+  Fl::repeat_timeout(0.25, refresh, ptr);
+
+  if (!tv->sink) {
+    return;
+  }
+
+  /* Always take the lines, so that the sink doesn't hold on to a backlog
+   * while the window is hidden */
+  auto lines = tv->sink->Take();
+  if (lines.empty() || !tv->visible()) {
+    return;
+  }
+
+  std::string text;
+  for (const auto &line : lines) {
+    text += line;
+    text += '\n';
+  }
+  tv->buffer->append(text.c_str());
+
+  int total = tv->buffer->count_lines(0, tv->buffer->length());
+  if (total > tv->max_lines) {
+    int end = tv->buffer->skip_lines(0, total - tv->max_lines);
+    tv->buffer->remove(0, end);
+  }
+
+  tv->display->insert_position(tv->buffer->length());
+  tv->display->show_insert_position();
+}
+
+void TraceViewWindow::levels_changed(Fl_Widget *w, void *ptr) {
+  auto tv = static_cast<TraceViewWindow *>(ptr);
+  if (!tv->tracer) {
+    return;
+  }
+  if (!tv->tracer->Configure(tv->levels->value())) {
+    std::cerr << "invalid trace levels: " << tv->levels->value() << std::endl;
+  }
+}
+
+void TraceViewWindow::clear_pressed(Fl_Widget *w, void *ptr) {
+  auto tv = static_cast<TraceViewWindow *>(ptr);
+  tv->buffer->text("");
+}
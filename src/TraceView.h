@@ -0,0 +1,39 @@
+#pragma once
+
+#include <memory>
+
+#include <FL/Fl.H>
+#include <FL/Fl_Button.H>
+#include <FL/Fl_Double_Window.H>
+#include <FL/Fl_Input.H>
+#include <FL/Fl_Text_Buffer.H>
+#include <FL/Fl_Text_Display.H>
+
+#include "Trace.h"
+
+/* Shows the protocol trace collected by a BufferTraceSink, and allows the
+ * per-type trace levels to be changed while running */
+class TraceViewWindow : public Fl_Double_Window {
+public:
+  TraceViewWindow(int X, int Y, int W, int H);
+  ~TraceViewWindow();
+
+  void set_tracer(std::shared_ptr<Tracer> tracer,
+                  std::shared_ptr<BufferTraceSink> sink);
+
+private:
+  std::shared_ptr<Tracer> tracer;
+  std::shared_ptr<BufferTraceSink> sink;
+
+  Fl_Input *levels;
+  Fl_Button *clear;
+  Fl_Text_Display *display;
+  Fl_Text_Buffer *buffer;
+
+  /* Oldest lines are dropped from the display beyond this */
+  int max_lines = 20000;
+
+  static void refresh(void *ptr);
+  static void levels_changed(Fl_Widget *w, void *ptr);
+  static void clear_pressed(Fl_Widget *w, void *ptr);
+};
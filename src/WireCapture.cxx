@@ -0,0 +1,184 @@
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <iterator>
+
+#include "WireCapture.h"
+
+static const char capture_magic[8] = {'V', 'I', 'A', 'W', 'C', 'A', 'P', '1'};
+
+/* Flush to disk once this much is pending, otherwise the writer thread picks
+ * up whatever is pending on its periodic wakeup */
+static const size_t capture_flush_threshold = 64 * 1024;
+
+static void append_le(std::vector<uint8_t> &buf, uint64_t value, int bytes) {
+  for (int i = 0; i < bytes; i++) {
+    buf.push_back((value >> (8 * i)) & 0xff);
+  }
+}
+
+static uint64_t read_le(const uint8_t *buf, int bytes) {
+  uint64_t value = 0;
+  for (int i = 0; i < bytes; i++) {
+    value |= (uint64_t)buf[i] << (8 * i);
+  }
+  return value;
+}
+
+static uint64_t ns_since_epoch(std::chrono::steady_clock::time_point t) {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             t.time_since_epoch())
+      .count();
+}
+
+static uint64_t ns_since_epoch(std::chrono::system_clock::time_point t) {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             t.time_since_epoch())
+      .count();
+}
+
+std::vector<WireFrame> ReadWireCapture(std::string path) {
+  std::ifstream file{path, std::ios::binary};
+  std::vector<uint8_t> contents{std::istreambuf_iterator<char>(file),
+                                std::istreambuf_iterator<char>()};
+
+  const size_t header_size = sizeof(capture_magic) + 16;
+  if ((contents.size() < header_size) ||
+      std::memcmp(contents.data(), capture_magic, sizeof(capture_magic))) {
+    std::cerr << "WireCapture: " << path << " is not a capture file"
+              << std::endl;
+    return {};
+  }
+
+  std::vector<WireFrame> frames;
+  size_t pos = header_size;
+  while (pos + 13 <= contents.size()) {
+    WireFrame frame;
+    frame.time_ns = read_le(&contents[pos], 8);
+    frame.direction = (WireDirection)contents[pos + 8];
+    size_t len = read_le(&contents[pos + 9], 4);
+    pos += 13;
+    if (pos + len > contents.size()) {
+      break;
+    }
+    frame.data.assign(contents.begin() + pos, contents.begin() + pos + len);
+    frames.push_back(std::move(frame));
+    pos += len;
+  }
+  return frames;
+}
+
+WireCapture::WireCapture(std::string path, size_t max_file_size,
+                         int max_files)
+    : path{path}, max_file_size{max_file_size}, max_files{max_files} {
+  open_file();
+  running = true;
+  thread = std::thread([](WireCapture *w) { w->write_loop(); }, this);
+}
+
+WireCapture::~WireCapture() {
+  std::unique_lock<std::mutex> lock(mutex);
+  running = false;
+  cv.notify_one();
+  lock.unlock();
+  thread.join();
+}
+
+void WireCapture::open_file() {
+  file.open(path, std::ios::binary | std::ios::trunc);
+  if (!file) {
+    std::cerr << "WireCapture: unable to open " << path << std::endl;
+    return;
+  }
+
+  std::vector<uint8_t> header{capture_magic,
+                              capture_magic + sizeof(capture_magic)};
+  append_le(header, ns_since_epoch(std::chrono::system_clock::now()), 8);
+  append_le(header, ns_since_epoch(std::chrono::steady_clock::now()), 8);
+  file.write((const char *)header.data(), header.size());
+  file_size = header.size();
+}
+
+void WireCapture::rotate() {
+  file.close();
+  for (int i = max_files - 1; i > 0; i--) {
+    auto from = (i == 1) ? path : path + "." + std::to_string(i - 1);
+    auto to = path + "." + std::to_string(i);
+    std::rename(from.c_str(), to.c_str());
+  }
+  open_file();
+}
+
+void WireCapture::Record(WireDirection dir, const uint8_t *data, size_t len) {
+  auto now = std::chrono::steady_clock::now();
+
+  std::unique_lock<std::mutex> lock(mutex);
+  append_le(pending, ns_since_epoch(now), 8);
+  pending.push_back((uint8_t)dir);
+  append_le(pending, len, 4);
+  pending.insert(pending.end(), data, data + len);
+
+  if (pending.size() >= capture_flush_threshold) {
+    cv.notify_one();
+  }
+}
+
+void WireCapture::write_loop() {
+  std::vector<uint8_t> writing;
+  while (true) {
+    std::unique_lock<std::mutex> lock(mutex);
+    if (running && (pending.size() < capture_flush_threshold)) {
+      cv.wait_for(lock, std::chrono::milliseconds{250});
+    }
+    bool stopping = !running;
+    std::swap(writing, pending);
+    lock.unlock();
+
+    if (!writing.empty() && file) {
+      file.write((const char *)writing.data(), writing.size());
+      file.flush();
+      file_size += writing.size();
+      /* With a single file, rotating just starts it over */
+      if (file_size >= max_file_size) {
+        rotate();
+      }
+    }
+    writing.clear();
+
+    if (stopping) {
+      return;
+    }
+  }
+}
+
+void CaptureInbuf::discard_consumed() {
+  auto consumed = consumed_size();
+  buffer.erase(buffer.begin(), buffer.begin() + consumed);
+  setg(buffer.data(), buffer.data(), buffer.data() + buffer.size());
+}
+
+CaptureInbuf::int_type CaptureInbuf::underflow() {
+  if (gptr() < egptr()) {
+    return traits_type::to_int_type(*gptr());
+  }
+
+  /* Block for at least one byte, then take whatever else the source already
+   * has buffered */
+  auto consumed = consumed_size();
+  int_type c = source->sbumpc();
+  if (traits_type::eq_int_type(c, traits_type::eof())) {
+    return traits_type::eof();
+  }
+  buffer.push_back(traits_type::to_char_type(c));
+
+  auto avail = source->in_avail();
+  if (avail > 0) {
+    auto old_size = buffer.size();
+    buffer.resize(old_size + avail);
+    auto got = source->sgetn(buffer.data() + old_size, avail);
+    buffer.resize(old_size + (got > 0 ? got : 0));
+  }
+
+  setg(buffer.data(), buffer.data() + consumed, buffer.data() + buffer.size());
+  return traits_type::to_int_type(*gptr());
+}
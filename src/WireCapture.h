@@ -0,0 +1,90 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <fstream>
+#include <mutex>
+#include <streambuf>
+#include <string>
+#include <thread>
+#include <vector>
+
+/* Binary capture of raw frames crossing the link to the target.
+ *
+ * A capture file starts with an 8 byte magic ("VIAWCAP1"), followed by the
+ * wall clock time (ns since epoch) and the monotonic time (ns) at which the
+ * file was opened, so monotonic frame times can be mapped back to real time.
+ * After that, each frame is stored as:
+ *   uint64 monotonic time (ns)
+ *   uint8  direction (0 = from target, 1 = to target)
+ *   uint32 length
+ *   length bytes of raw CBOR
+ * All integers are little endian.
+ */
+
+enum class WireDirection : uint8_t {
+  Inbound = 0,
+  Outbound = 1,
+};
+
+struct WireFrame {
+  uint64_t time_ns;
+  WireDirection direction;
+  std::vector<uint8_t> data;
+};
+
+/* Read every complete frame from a capture file. A truncated final frame, as
+ * left by an unclean shutdown, is ignored */
+std::vector<WireFrame> ReadWireCapture(std::string path);
+
+class WireCapture {
+  std::string path;
+  size_t max_file_size;
+  int max_files;
+
+  std::mutex mutex;
+  std::condition_variable cv;
+  std::vector<uint8_t> pending;
+  std::thread thread;
+  std::atomic<bool> running;
+
+  std::ofstream file;
+  size_t file_size;
+
+  void open_file();
+  void rotate();
+  void write_loop();
+
+public:
+  WireCapture(std::string path, size_t max_file_size = 64 * 1024 * 1024,
+              int max_files = 4);
+  WireCapture(const WireCapture &) = delete;
+  WireCapture &operator=(const WireCapture &) = delete;
+  ~WireCapture();
+
+  /* Safe to call from any thread. The frame is only copied into a pending
+   * buffer here, the file is written by a background thread */
+  void Record(WireDirection dir, const uint8_t *data, size_t len);
+};
+
+/* Streambuf that passes through reads from another streambuf while keeping
+ * the bytes that have been consumed, so the raw bytes of a frame that was
+ * just decoded can be recorded without re-encoding it */
+class CaptureInbuf : public std::streambuf {
+  std::streambuf *source;
+  std::vector<char> buffer;
+
+public:
+  CaptureInbuf(std::streambuf *src) : source{src} {}
+
+  const uint8_t *consumed_data() const {
+    return reinterpret_cast<const uint8_t *>(eback());
+  }
+  size_t consumed_size() const { return gptr() - eback(); }
+  void discard_consumed();
+
+protected:
+  virtual int_type underflow();
+};
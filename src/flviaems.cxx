@@ -5,8 +5,6 @@
 #include <iostream>
 #include <memory>
 
-#include <pstream.h>
-#include <termios.h>
 #include <unistd.h>
 
 #include "MainWindow.h"
@@ -14,172 +12,18 @@
 #include <FL/Fl_File_Chooser.H>
 #include <FL/Fl_Window.H>
 
-#include "fdstream.h"
+#include "ConfigCache.h"
+#include "Connection.h"
+#include "DiagnosticsView.h"
+#include "ReplayConnection.h"
+#include "Trace.h"
+#include "TraceView.h"
+#include "WireCapture.h"
 #include "viaems.h"
 
-#include <arpa/inet.h>
-#include <netinet/in.h>
-#include <sys/socket.h>
-#include <sys/types.h>
-
 #include <nlohmann/json.hpp>
 using json = json;
 
-struct ThreadedJsonInterface {
-  std::shared_ptr<std::ostream> writer;
-  std::shared_ptr<std::istream> reader;
-
-  std::thread reader_thread;
-  std::deque<json> in_messages;
-  std::mutex in_mutex;
-  Fl_Awake_Handler handler;
-  void *handler_ptr;
-
-  std::atomic<bool> running;
-
-  static void do_reader_thread(ThreadedJsonInterface *self) {
-    while (self->running) {
-      try {
-        auto msg = json::from_cbor(*self->reader, false);
-        std::unique_lock<std::mutex> lock(self->in_mutex);
-        self->in_messages.push_back(std::move(msg));
-        lock.unlock();
-        Fl::awake(self->handler, self->handler_ptr);
-      } catch (json::parse_error &e) {
-        std::cerr << "parse_error: " << e.what() << std::endl;
-        if (self->reader->fail() || self->reader->eof()) {
-          self->running = false;
-        }
-      }
-    }
-  }
-
-public:
-  ThreadedJsonInterface(std::shared_ptr<std::istream> is,
-                        std::shared_ptr<std::ostream> os,
-                        Fl_Awake_Handler read_handler, void *ptr)
-      : writer{os}, reader{is}, handler{read_handler}, handler_ptr{ptr} {
-    running = true;
-    this->reader_thread = std::thread(
-        [](ThreadedJsonInterface *s) { s->do_reader_thread(s); }, this);
-  }
-
-  ~ThreadedJsonInterface() {
-    running = false;
-    reader_thread.join();
-  }
-
-  void Write(const json &msg) {
-    auto bytes = json::to_cbor(msg);
-    writer->write((const char *)bytes.data(), bytes.size());
-    writer->flush();
-  }
-
-  std::optional<json> Read() {
-    std::unique_lock<std::mutex> lock(in_mutex);
-    if (in_messages.empty()) {
-      return {};
-    }
-    auto msg = std::move(in_messages[0]);
-    in_messages.pop_front();
-    return msg;
-  }
-};
-
-class ExecConnection : public viaems::Connection {
-  std::shared_ptr<redi::pstream> stream;
-  std::unique_ptr<ThreadedJsonInterface> conn;
-
-public:
-  ExecConnection(Fl_Awake_Handler read_handler, void *ptr, std::string path) {
-    stream = std::make_shared<redi::pstream>(path);
-    conn = std::make_unique<ThreadedJsonInterface>(stream, stream, read_handler,
-                                                   ptr);
-  }
-
-  virtual void Write(const json &msg) { conn->Write(msg); }
-  virtual std::optional<json> Read() { return conn->Read(); }
-};
-
-class DevConnection : public viaems::Connection {
-  std::unique_ptr<ThreadedJsonInterface> conn;
-  int fd;
-  std::shared_ptr<fdistream> istream;
-  std::shared_ptr<fdostream> ostream;
-
-  bool set_raw_mode() {
-    struct termios tty;
-    if (tcgetattr(fd, &tty) != 0) {
-      return false;
-    }
-
-    cfmakeraw(&tty);
-    if (tcsetattr(fd, 0, &tty) != 0) {
-      return false;
-    }
-    return true;
-  }
-
-public:
-  DevConnection(Fl_Awake_Handler read_handler, void *ptr, std::string path) {
-    fd = open(path.c_str(), O_RDWR);
-    if (fd < 0) {
-      throw std::runtime_error{"Failed to open device"};
-    }
-    set_raw_mode();
-    istream = std::make_unique<fdistream>(fd);
-    ostream = std::make_unique<fdostream>(fd);
-    conn = std::make_unique<ThreadedJsonInterface>(istream, ostream,
-                                                   read_handler, ptr);
-  }
-
-  virtual ~DevConnection() { close(fd); }
-  virtual void Write(const json &msg) { conn->Write(msg); }
-  virtual std::optional<json> Read() { return conn->Read(); }
-};
-
-class UdpConnection : public viaems::Connection {
-  std::unique_ptr<ThreadedJsonInterface> conn;
-  int fd;
-  std::shared_ptr<fdistream> istream;
-  std::shared_ptr<fdostream> ostream;
-
-public:
-  UdpConnection(Fl_Awake_Handler read_handler, void *ptr,
-                std::string local_addr = "127.0.0.1",
-                uint16_t local_port = 5556,
-                std::string target_addr = "127.0.0.1",
-                uint16_t target_port = 5555) {
-    fd = socket(AF_INET, SOCK_DGRAM, 0);
-    if (fd < 0) {
-      throw std::runtime_error{"Failed to open socket"};
-    }
-
-    struct sockaddr_in sockaddr;
-    sockaddr.sin_family = AF_INET;
-    sockaddr.sin_addr.s_addr = inet_addr(local_addr.c_str());
-    sockaddr.sin_port = htons(local_port);
-    if (bind(fd, (struct sockaddr *)&sockaddr, sizeof(sockaddr)) < 0) {
-      throw std::runtime_error{"Failed to bind"};
-    }
-
-    sockaddr.sin_addr.s_addr = inet_addr(target_addr.c_str());
-    sockaddr.sin_port = htons(target_port);
-    if (connect(fd, (struct sockaddr *)&sockaddr, sizeof(sockaddr)) < 0) {
-      throw std::runtime_error{"Failed to connect"};
-    }
-
-    istream = std::make_unique<fdistream>(fd);
-    ostream = std::make_unique<fdostream>(fd);
-    conn = std::make_unique<ThreadedJsonInterface>(istream, ostream,
-                                                   read_handler, ptr);
-  }
-
-  virtual ~UdpConnection() { close(fd); }
-  virtual void Write(const json &msg) { conn->Write(msg); }
-  virtual std::optional<json> Read() { return conn->Read(); }
-};
-
 class FLViaems {
   MainWindow ui;
   viaems::Model model;
@@ -188,13 +32,30 @@ class FLViaems {
   std::shared_ptr<Log> log_reader;
   std::shared_ptr<ThreadedWriteLog> log_writer;
   std::shared_ptr<viaems::Request> ping_req;
+  std::shared_ptr<WireCapture> wire_capture;
+
+  std::shared_ptr<Tracer> tracer;
+  std::shared_ptr<BufferTraceSink> trace_buffer;
+  std::shared_ptr<StderrTraceSink> trace_stderr;
+  bool trace_levels_given = false;
+  bool tracing_file = false;
+  std::unique_ptr<TraceViewWindow> trace_view;
+  std::unique_ptr<DiagnosticsWindow> diagnostics;
 
   bool offline = true;
-  int trace_level = 0;
+  bool model_built = false;
+  int last_complete_nodes = 0;
+  std::vector<ConfigValueRecord> confirmed_values;
 
   static void feed_refresh_handler(void *ptr) {
     auto v = static_cast<FLViaems *>(ptr);
 
+    v->model.poll();
+    if (v->protocol) {
+      v->protocol->Poll();
+    }
+    v->flush_confirmed_values();
+
     auto updates =
         v->protocol ? v->protocol->FeedUpdates() : viaems::LogChunk{};
     static std::deque<int> rates;
@@ -237,35 +98,79 @@ class FLViaems {
   static void interrogate_update(viaems::InterrogationState s, void *ptr) {
     auto v = static_cast<FLViaems *>(ptr);
 
-    v->ui.update_interrogation(s.in_progress, s.complete_nodes, s.total_nodes);
-    if (!s.in_progress) {
+    v->ui.update_interrogation(s.in_progress || s.revalidating,
+                               s.complete_nodes, s.total_nodes);
+
+    /* The tree is built as soon as the structure is known, values fill in
+     * through value_update as they arrive */
+    if (s.have_structure && !v->model_built) {
       v->ui.update_model(&v->model);
-      if (v->log_writer) {
-        v->log_writer->SaveConfig(v->model.configuration());
-      }
+      v->model_built = true;
+    }
+    if (!s.in_progress && !s.revalidating && v->log_writer) {
+      v->log_writer->SaveConfig(v->model.configuration());
     }
   }
 
   void start_interrogation() {
     model.interrogate(interrogate_update, this);
+    model_built = false;
+    last_complete_nodes = 0;
+    Fl::remove_timeout(failed_structure_callback, this);
     Fl::add_timeout(8, failed_structure_callback, this);
   }
 
   static void value_update(viaems::StructurePath path, void *ptr) {
     auto v = static_cast<FLViaems *>(ptr);
-    auto value = v->model.configuration().get(path).value_or(uint32_t{0});
-    v->ui.update_config_value(path, value);
+    auto value = v->model.configuration().find(path);
+    if (value) {
+      v->ui.update_config_value(path, *value);
+    }
+  }
+
+  /* The log's timeline only holds values the target has */
+  static void value_confirmed(viaems::StructurePath path, void *ptr) {
+    auto v = static_cast<FLViaems *>(ptr);
+    auto value = v->model.confirmed_value(path);
+    if (value && v->log_writer) {
+      v->confirmed_values.push_back(ConfigValueRecord{
+          .time = std::chrono::system_clock::now(),
+          .path = path,
+          .value = *value,
+      });
+    }
+  }
+
+  /* Values confirmed while handling messages, such as the baseline at the
+   * end of an interrogation, go to the writer thread as one batch */
+  void flush_confirmed_values() {
+    if (!confirmed_values.empty() && log_writer) {
+      log_writer->RecordConfigValues(std::move(confirmed_values));
+    }
+    confirmed_values.clear();
+  }
+
+  static void value_rollback(viaems::StructurePath path, void *ptr) {
+    auto v = static_cast<FLViaems *>(ptr);
+    v->ui.show_config_rollback(path);
   }
 
   static void failed_structure_callback(void *ptr) {
     auto v = static_cast<FLViaems *>(ptr);
 
     auto is = v->model.interrogation_status();
-    if (is.in_progress) {
-      std::cerr << "redoing structure" << is.complete_nodes << " "
+    if (!is.in_progress && !is.revalidating) {
+      return;
+    }
+
+    /* Only step in if nothing has arrived since the last check */
+    if (is.complete_nodes == v->last_complete_nodes) {
+      std::cerr << "resuming interrogation " << is.complete_nodes << " "
                 << is.total_nodes << std::endl;
-      v->start_interrogation();
+      v->model.resume_interrogation(interrogate_update, v);
     }
+    v->last_complete_nodes = is.complete_nodes;
+    Fl::repeat_timeout(8, failed_structure_callback, v);
   }
 
   static void ping_callback(void *ptr) {
@@ -292,6 +197,34 @@ class FLViaems {
     Fl::repeat_timeout(1, v->pinger, v);
   }
 
+  static void diagnostics_refresh(void *ptr) {
+    auto v = static_cast<FLViaems *>(ptr);
+    if (!v->diagnostics->visible()) {
+      return;
+    }
+    v->diagnostics->update(v->protocol ? v->protocol->Metrics()
+                                       : ProtocolMetrics{});
+    Fl::repeat_timeout(1, diagnostics_refresh, v);
+  }
+
+  static void show_diagnostics_cb(Fl_Widget *w, void *ptr) {
+    auto v = static_cast<FLViaems *>(ptr);
+    if (!v->diagnostics) {
+      v->diagnostics = std::make_unique<DiagnosticsWindow>(150, 150, 700, 500);
+      v->diagnostics->reset_callback(reset_metrics_cb, v);
+    }
+    v->diagnostics->show();
+    Fl::remove_timeout(diagnostics_refresh, v);
+    Fl::add_timeout(0, diagnostics_refresh, v);
+  }
+
+  static void reset_metrics_cb(Fl_Widget *w, void *ptr) {
+    auto v = static_cast<FLViaems *>(ptr);
+    if (v->protocol) {
+      v->protocol->ResetMetrics();
+    }
+  }
+
   static void flash(Fl_Widget *w, void *ptr) {
     auto v = static_cast<FLViaems *>(ptr);
     v->protocol->Flash();
@@ -323,6 +256,25 @@ class FLViaems {
     v->connect_device("/dev/ttyACM0");
   }
 
+  static void undo_cb(Fl_Widget *w, void *ptr) {
+    auto v = static_cast<FLViaems *>(ptr);
+    v->model.undo();
+  }
+
+  static void redo_cb(Fl_Widget *w, void *ptr) {
+    auto v = static_cast<FLViaems *>(ptr);
+    v->model.redo();
+  }
+
+  static void show_trace_cb(Fl_Widget *w, void *ptr) {
+    auto v = static_cast<FLViaems *>(ptr);
+    if (!v->trace_view) {
+      v->trace_view = std::make_unique<TraceViewWindow>(100, 100, 900, 500);
+      v->trace_view->set_tracer(v->tracer, v->trace_buffer);
+    }
+    v->trace_view->show();
+  }
+
   static void initialize_offline(Fl_Widget *w, void *ptr) {
     auto v = static_cast<FLViaems *>(ptr);
     v->protocol.reset();
@@ -335,19 +287,26 @@ class FLViaems {
     if (v->protocol) {
       v->protocol->NewData();
     }
+    v->flush_confirmed_values();
+  }
+
+  static void awake_message_available(void *ptr) {
+    Fl::awake(message_available, ptr);
+  }
+
+  static void upload_update(viaems::UploadState s, void *ptr) {
+    auto v = static_cast<FLViaems *>(ptr);
+    v->ui.update_upload(s.in_progress, s.complete, s.total);
   }
 
   void load_config(viaems::Configuration conf) {
+    /* Write what differs to the target, compared before the model takes on
+     * the new values */
+    if (!offline) {
+      model.upload(conf, upload_update, this);
+    }
     model.set_configuration(conf);
     ui.update_model(&model);
-
-    /* Write all new config to target explicitly */
-    if (offline) {
-      return;
-    }
-    for (auto &[path, value] : conf.values) {
-      model.set_value(path, value);
-    }
   }
 
   static void export_config(Fl_Widget *w, void *ptr) {
@@ -356,9 +315,8 @@ class FLViaems {
     if (filename == nullptr) {
       return;
     }
-    auto jsonconf = v->model.configuration().to_json();
     std::ofstream dump_file{filename};
-    dump_file << jsonconf.dump(4);
+    v->model.configuration().write_json(dump_file, 4);
     dump_file.close();
   }
 
@@ -380,10 +338,27 @@ class FLViaems {
   }
 
 public:
-  void set_trace(int t) {
-    this->trace_level = t;
-    if (this->protocol) {
-      this->protocol->SetTrace(t);
+  /* Trace to stderr, spec is as for Tracer::Configure */
+  void set_trace(std::string spec) {
+    if (!trace_stderr) {
+      trace_stderr = std::make_shared<StderrTraceSink>();
+      tracer->AddSink(trace_stderr);
+    }
+    trace_levels_given = true;
+    if (!tracer->Configure(spec)) {
+      std::cerr << "invalid trace levels: " << spec << std::endl;
+    }
+  }
+
+  void set_trace_file(std::string filename) {
+    tracing_file = true;
+    tracer->AddSink(std::make_shared<FileTraceSink>(filename));
+  }
+
+  /* A trace file with no -t traces at level 1, as in the logger */
+  void default_trace_levels() {
+    if (tracing_file && !trace_levels_given) {
+      tracer->SetLevel(1);
     }
   }
 
@@ -393,28 +368,42 @@ public:
     ui.update_log(log_reader);
   }
 
+  void set_wire_capture(std::string filename) {
+    wire_capture = std::make_shared<WireCapture>(filename);
+  }
+
   void connect_device(std::string device) {
-    auto conn =
-        std::make_unique<DevConnection>(this->message_available, this, device);
+    auto conn = std::make_unique<DevConnection>(
+        this->awake_message_available, this, device, wire_capture);
     this->protocol = std::make_unique<viaems::Protocol>(std::move(conn));
-    this->protocol->SetTrace(this->trace_level);
+    this->protocol->SetTracer(this->tracer);
     this->model.set_protocol(this->protocol);
     this->offline = false;
   }
 
   void connect_sim_exec(std::string path) {
-    auto conn =
-        std::make_unique<ExecConnection>(this->message_available, this, path);
+    auto conn = std::make_unique<ExecConnection>(
+        this->awake_message_available, this, path, wire_capture);
     this->protocol = std::make_unique<viaems::Protocol>(std::move(conn));
-    this->protocol->SetTrace(this->trace_level);
+    this->protocol->SetTracer(this->tracer);
     this->model.set_protocol(this->protocol);
     this->offline = false;
   }
 
   void connect_sim_udp() {
-    auto conn = std::make_unique<UdpConnection>(this->message_available, this);
+    auto conn = std::make_unique<UdpConnection>(this->awake_message_available,
+                                                this, wire_capture);
+    this->protocol = std::make_unique<viaems::Protocol>(std::move(conn));
+    this->protocol->SetTracer(this->tracer);
+    this->model.set_protocol(this->protocol);
+    this->offline = false;
+  }
+
+  void connect_replay(std::string path, double speed) {
+    auto conn = std::make_unique<ReplayConnection>(
+        this->awake_message_available, this, path, speed);
     this->protocol = std::make_unique<viaems::Protocol>(std::move(conn));
-    this->protocol->SetTrace(this->trace_level);
+    this->protocol->SetTracer(this->tracer);
     this->model.set_protocol(this->protocol);
     this->offline = false;
   }
@@ -422,6 +411,12 @@ public:
   FLViaems() {
     Fl::lock(); /* Necessary to enable awake() functionality */
 
+    tracer = std::make_shared<Tracer>();
+    trace_buffer = std::make_shared<BufferTraceSink>();
+    tracer->AddSink(trace_buffer);
+
+    model.set_cache(std::make_shared<ConfigCache>(ConfigCache::default_path()));
+
     Fl::add_timeout(0.05, feed_refresh_handler, this);
     Fl::add_timeout(1, pinger, this);
 
@@ -430,12 +425,19 @@ public:
     ui.m_file_open->callback(select_log, this);
     ui.m_file_export->callback(export_config, this);
     ui.m_file_import->callback(import_config, this);
+    ui.m_edit_undo->callback(undo_cb, this);
+    ui.m_edit_redo->callback(redo_cb, this);
     ui.m_connection_simulator->callback(select_sim_cb, this);
     ui.m_connection_device->callback(select_device_cb, this);
     ui.m_connection_offline->callback(initialize_offline, this);
+    ui.m_connection_trace->callback(show_trace_cb, this);
+    ui.m_connection_diagnostics->callback(show_diagnostics_cb, this);
     ui.set_load_config_callback(
         std::bind(&FLViaems::load_config, this, std::placeholders::_1));
     model.set_value_change_callback(value_update, this);
+    model.set_rollback_callback(value_rollback, this);
+    model.set_confirmed_value_callback(value_confirmed, this);
+    model.set_optimistic(true);
   };
 
   ~FLViaems(){};
@@ -445,27 +447,53 @@ int main(int argc, char *argv[]) {
   FLViaems controller{};
 
   int opt;
-  int tracelevel = 0;
-  while ((opt = getopt(argc, argv, "d:s:f:t:u")) != -1) {
+  /* Connect only after all options are parsed, so that options affecting the
+   * connection (such as -w) apply regardless of their order */
+  std::function<void()> connect;
+  double replay_speed = 1.0;
+  while ((opt = getopt(argc, argv, "d:s:f:t:T:uw:r:x:")) != -1) {
     switch (opt) {
     case 'd':
-      controller.connect_device(optarg);
+      connect = [&controller, dev = std::string{optarg}]() {
+        controller.connect_device(dev);
+      };
       break;
     case 's':
-      controller.connect_sim_exec(optarg);
+      connect = [&controller, path = std::string{optarg}]() {
+        controller.connect_sim_exec(path);
+      };
       break;
     case 'u':
-      controller.connect_sim_udp();
+      connect = [&controller]() { controller.connect_sim_udp(); };
+      break;
+    case 'r':
+      connect = [&controller, &replay_speed, path = std::string{optarg}]() {
+        controller.connect_replay(path, replay_speed);
+      };
+      break;
+    case 'x':
+      /* Replay speed multiplier, 0 replays as fast as possible */
+      replay_speed = atof(optarg);
+      break;
+    case 'w':
+      controller.set_wire_capture(optarg);
       break;
     case 'f':
       controller.set_logfile(optarg);
       break;
     case 't':
-      tracelevel = atoi(optarg);
-      controller.set_trace(tracelevel);
+      /* A trace level, or per-type levels such as "feed=1,response=2" */
+      controller.set_trace(optarg);
+      break;
+    case 'T':
+      controller.set_trace_file(optarg);
       break;
     }
   }
+  controller.default_trace_levels();
+  if (connect) {
+    connect();
+  }
 
   Fl::run();
   return 0;
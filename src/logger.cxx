@@ -0,0 +1,326 @@
+/* Headless logger: connects to a target, interrogates its configuration and
+ * logs the feed at full rate to a log file, with no UI dependency.
+ *
+ *   viaems-logger -f <log> (-d <device> | -s <exec> | -u | -r <capture>)
+ *                 [-x <replay speed>] [-w <capture>] [-t <trace levels>]
+ *                 [-T <trace file>] [-i <flush interval ms>]
+ *                 [-C <config cache>]
+ *
+ * A trace file with no -t traces at level 1: every message but the feed and
+ * descriptions.
+ */
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <csignal>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <mutex>
+
+#include <unistd.h>
+
+#include "ConfigCache.h"
+#include "Connection.h"
+#include "Log.h"
+#include "ReplayConnection.h"
+#include "Trace.h"
+#include "WireCapture.h"
+#include "viaems.h"
+
+static std::atomic<bool> stop_requested{false};
+
+static void handle_stop_signal(int) { stop_requested = true; }
+
+class Logger {
+  using clock = std::chrono::steady_clock;
+
+  /* Declared first so they outlive the connection's reader thread */
+  std::mutex mutex;
+  std::condition_variable cv;
+  bool message_pending = false;
+
+  viaems::Model model;
+  std::shared_ptr<viaems::Protocol> protocol;
+  std::shared_ptr<ThreadedWriteLog> log_writer;
+  std::shared_ptr<WireCapture> wire_capture;
+  ReplayConnection *replay = nullptr;
+  std::shared_ptr<Tracer> tracer = std::make_shared<Tracer>();
+  bool tracing_stderr = false;
+  bool trace_levels_given = false;
+  bool tracing_file = false;
+
+  std::shared_ptr<viaems::Request> ping_req;
+  clock::time_point ping_deadline;
+  bool first_pong = true;
+  clock::time_point interrogation_deadline;
+  bool interrogating = false;
+  int last_complete_nodes = 0;
+  std::vector<ConfigValueRecord> confirmed_values;
+
+  uint64_t points_logged = 0;
+
+  static void message_available(void *ptr) {
+    auto l = static_cast<Logger *>(ptr);
+    std::unique_lock<std::mutex> lock(l->mutex);
+    l->message_pending = true;
+    l->cv.notify_one();
+  }
+
+  static void ping_callback(void *ptr) {
+    auto l = static_cast<Logger *>(ptr);
+    l->ping_req.reset();
+    if (l->first_pong) {
+      l->first_pong = false;
+      l->start_interrogation();
+    }
+  }
+
+  static void interrogate_update(viaems::InterrogationState s, void *ptr) {
+    auto l = static_cast<Logger *>(ptr);
+    if (l->interrogating && !s.in_progress && !s.revalidating) {
+      l->interrogating = false;
+      std::cerr << "logger: interrogated " << s.total_nodes << " nodes"
+                << std::endl;
+      l->log_writer->SaveConfig(l->model.configuration());
+    }
+  }
+
+  static void value_confirmed(viaems::StructurePath path, void *ptr) {
+    auto l = static_cast<Logger *>(ptr);
+    auto value = l->model.confirmed_value(path);
+    if (value) {
+      l->confirmed_values.push_back(ConfigValueRecord{
+          .time = std::chrono::system_clock::now(),
+          .path = path,
+          .value = *value,
+      });
+    }
+  }
+
+  /* One batch per pass, so an interrogation's baseline is one transaction */
+  void flush_confirmed_values() {
+    if (!confirmed_values.empty()) {
+      log_writer->RecordConfigValues(std::move(confirmed_values));
+    }
+    confirmed_values.clear();
+  }
+
+  void start_interrogation() {
+    interrogating = true;
+    interrogation_deadline = clock::now() + std::chrono::seconds{8};
+    last_complete_nodes = 0;
+    model.interrogate(interrogate_update, this);
+  }
+
+  void check_interrogation(clock::time_point now) {
+    interrogation_deadline = now + std::chrono::seconds{8};
+
+    /* Only step in if nothing has arrived since the last check */
+    auto is = model.interrogation_status();
+    if (is.complete_nodes == last_complete_nodes) {
+      std::cerr << "logger: resuming interrogation" << std::endl;
+      model.resume_interrogation(interrogate_update, this);
+    }
+    last_complete_nodes = is.complete_nodes;
+  }
+
+  void ping(clock::time_point now) {
+    if (ping_req) {
+      if (now < ping_deadline) {
+        return;
+      }
+      protocol->Cancel(ping_req);
+      ping_req.reset();
+      std::cerr << "logger: failed ping" << std::endl;
+    }
+    ping_req = protocol->Ping(ping_callback, this);
+    ping_deadline = now + std::chrono::milliseconds{500};
+  }
+
+  void flush_feed() {
+    auto updates = protocol->FeedUpdates();
+    if (updates.points.size() > 0) {
+      points_logged += updates.points.size();
+      log_writer->WriteChunk(std::move(updates));
+    }
+  }
+
+  void connect(std::unique_ptr<viaems::Connection> conn) {
+    protocol = std::make_shared<viaems::Protocol>(std::move(conn));
+    protocol->SetTracer(tracer);
+    model.set_protocol(protocol);
+  }
+
+public:
+  /* Trace to stderr, spec is as for Tracer::Configure */
+  void set_trace(std::string spec) {
+    if (!tracing_stderr) {
+      tracing_stderr = true;
+      tracer->AddSink(std::make_shared<StderrTraceSink>());
+    }
+    trace_levels_given = true;
+    if (!tracer->Configure(spec)) {
+      std::cerr << "logger: invalid trace levels: " << spec << std::endl;
+    }
+  }
+
+  void set_config_cache(std::string filename) {
+    model.set_cache(std::make_shared<ConfigCache>(filename));
+  }
+
+  void set_trace_file(std::string filename) {
+    tracing_file = true;
+    tracer->AddSink(std::make_shared<FileTraceSink>(filename));
+  }
+
+  /* Called once all options are parsed, so -t applies in any order */
+  void default_trace_levels() {
+    if (tracing_file && !trace_levels_given) {
+      tracer->SetLevel(1);
+    }
+  }
+
+  void set_logfile(std::string filename) {
+    log_writer = std::make_shared<ThreadedWriteLog>(filename);
+  }
+
+  void set_wire_capture(std::string filename) {
+    wire_capture = std::make_shared<WireCapture>(filename);
+  }
+
+  void connect_device(std::string device) {
+    connect(std::make_unique<DevConnection>(message_available, this, device,
+                                            wire_capture));
+  }
+
+  void connect_sim_exec(std::string path) {
+    connect(std::make_unique<ExecConnection>(message_available, this, path,
+                                             wire_capture));
+  }
+
+  void connect_sim_udp() {
+    connect(std::make_unique<UdpConnection>(message_available, this,
+                                            wire_capture));
+  }
+
+  void connect_replay(std::string path, double speed) {
+    auto conn =
+        std::make_unique<ReplayConnection>(message_available, this, path, speed);
+    replay = conn.get();
+    connect(std::move(conn));
+  }
+
+  int run(std::chrono::milliseconds flush_interval) {
+    if (!protocol || !log_writer) {
+      std::cerr << "logger: a connection and a log file are required"
+                << std::endl;
+      return 1;
+    }
+
+    model.set_confirmed_value_callback(value_confirmed, this);
+
+    auto start = clock::now();
+    auto next_flush = start + flush_interval;
+    auto next_ping = start;
+
+    while (!stop_requested) {
+      std::unique_lock<std::mutex> lock(mutex);
+      cv.wait_until(lock, std::min(next_flush, next_ping),
+                    [this]() { return message_pending; });
+      message_pending = false;
+      lock.unlock();
+
+      protocol->NewData();
+      protocol->Poll();
+      flush_confirmed_values();
+
+      auto now = clock::now();
+      if (now >= next_flush) {
+        flush_feed();
+        next_flush = now + flush_interval;
+      }
+      if (now >= next_ping) {
+        ping(now);
+        next_ping = now + std::chrono::seconds{1};
+      }
+      if (interrogating && (now >= interrogation_deadline)) {
+        check_interrogation(now);
+      }
+      if (replay && replay->Finished()) {
+        break;
+      }
+    }
+    flush_feed();
+    flush_confirmed_values();
+
+    std::chrono::duration<double> elapsed = clock::now() - start;
+    std::cerr << "logger: logged " << points_logged << " points in "
+              << elapsed.count() << " s ("
+              << points_logged / elapsed.count() << " points/s)" << std::endl;
+    std::cerr << format_metrics(protocol->Metrics());
+    return 0;
+  }
+};
+
+int main(int argc, char *argv[]) {
+  Logger logger;
+
+  int opt;
+  std::function<void()> connect;
+  double replay_speed = 1.0;
+  auto flush_interval = std::chrono::milliseconds{250};
+  while ((opt = getopt(argc, argv, "d:s:ur:x:f:t:T:w:i:C:")) != -1) {
+    switch (opt) {
+    case 'd':
+      connect = [&logger, dev = std::string{optarg}]() {
+        logger.connect_device(dev);
+      };
+      break;
+    case 's':
+      connect = [&logger, path = std::string{optarg}]() {
+        logger.connect_sim_exec(path);
+      };
+      break;
+    case 'u':
+      connect = [&logger]() { logger.connect_sim_udp(); };
+      break;
+    case 'r':
+      connect = [&logger, &replay_speed, path = std::string{optarg}]() {
+        logger.connect_replay(path, replay_speed);
+      };
+      break;
+    case 'x':
+      replay_speed = atof(optarg);
+      break;
+    case 'f':
+      logger.set_logfile(optarg);
+      break;
+    case 't':
+      logger.set_trace(optarg);
+      break;
+    case 'T':
+      logger.set_trace_file(optarg);
+      break;
+    case 'w':
+      logger.set_wire_capture(optarg);
+      break;
+    case 'i':
+      flush_interval = std::chrono::milliseconds{atoi(optarg)};
+      break;
+    case 'C':
+      logger.set_config_cache(optarg);
+      break;
+    }
+  }
+  logger.default_trace_levels();
+  if (connect) {
+    connect();
+  }
+
+  std::signal(SIGINT, handle_stop_signal);
+  std::signal(SIGTERM, handle_stop_signal);
+
+  return logger.run(flush_interval);
+}
@@ -0,0 +1,421 @@
+/* Self-contained stand-in for a ViaEMS target, speaking the same CBOR
+ * protocol as the real firmware. Used for benchmarking and integration
+ * testing without hardware or a hosted firmware build.
+ *
+ * Transports:
+ *   (default)  stdin/stdout, for use with flviaems -s
+ *   -p         a pseudo terminal, whose path is printed on stderr, for -d
+ *   -u         UDP, listening on 127.0.0.1:5555 and sending to :5556, for -u
+ *
+ * Load options:
+ *   -r <hz>     feed rate (default 1000)
+ *   -c <count>  extra feed channels (default 16)
+ *   -l <count>  extra config leaves (default 0)
+ *   -d <ratio>  fraction of feed frames to drop, simulating link loss
+ *   -e <ratio>  fraction of responses to drop
+ */
+
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+
+#include "fdstream.h"
+
+#include <nlohmann/json.hpp>
+using json = nlohmann::json;
+
+enum class Transport {
+  Stdio,
+  Pty,
+  Udp,
+};
+
+struct MockOptions {
+  Transport transport = Transport::Stdio;
+  double rate = 1000;
+  int channels = 16;
+  int leaves = 0;
+  double drop = 0;
+  double drop_responses = 0;
+};
+
+class MockEcu {
+  MockOptions options;
+  int in_fd = -1;
+  int out_fd = -1;
+
+  std::mutex write_mutex;
+  std::atomic<bool> running;
+
+  json structure;
+  json types;
+  json config;
+  std::vector<std::string> feed_keys;
+
+  void write_message(const json &msg) {
+    auto bytes = json::to_cbor(msg);
+    std::unique_lock<std::mutex> lock(write_mutex);
+    if (options.transport == Transport::Udp) {
+      send(out_fd, bytes.data(), bytes.size(), 0);
+      return;
+    }
+    size_t written = 0;
+    while (written < bytes.size()) {
+      auto res = write(out_fd, bytes.data() + written, bytes.size() - written);
+      if (res <= 0) {
+        running = false;
+        return;
+      }
+      written += res;
+    }
+  }
+
+  void add_leaf(json &s, json &c, std::string name, std::string type,
+                json value, std::string description,
+                std::vector<std::string> choices = {}) {
+    s[name] = json{{"_type", type}, {"description", description}};
+    if (!choices.empty()) {
+      s[name]["choices"] = choices;
+    }
+    c[name] = value;
+  }
+
+  static json make_table(std::string title, int rows, int cols) {
+    json h_axis{{"name", "RPM"}, {"values", json::array()}};
+    json v_axis{{"name", "MAP"}, {"values", json::array()}};
+    json data = json::array();
+    for (int c = 0; c < cols; c++) {
+      h_axis["values"].push_back(c * 500.0);
+    }
+    for (int r = 0; r < rows; r++) {
+      v_axis["values"].push_back(20.0 + r * 10.0);
+      json row = json::array();
+      for (int c = 0; c < cols; c++) {
+        row.push_back(50.0 + r + c);
+      }
+      data.push_back(row);
+    }
+    return json{{"title", title},
+                {"num-axis", 2},
+                {"horizontal-axis", h_axis},
+                {"vertical-axis", v_axis},
+                {"data", data}};
+  }
+
+  static json make_sensor(uint32_t pin) {
+    return json{
+        {"source", "adc"},      {"method", "linear"},  {"pin", pin},
+        {"lag", 0.0},           {"fault-min", 0},      {"fault-max", 4095},
+        {"fault-value", 0.0},   {"range-min", 0.0},    {"range-max", 250.0},
+        {"raw-min", 0.0},       {"raw-max", 4095.0},
+    };
+  }
+
+  void build_config() {
+    structure = json::object();
+    config = json::object();
+
+    add_leaf(structure["tables"], config["tables"], "ve", "table",
+             make_table("ve", 16, 16), "Volumetric efficiency");
+    add_leaf(structure["tables"], config["tables"], "timing", "table",
+             make_table("timing", 16, 16), "Ignition advance");
+
+    auto sensor_choices = std::vector<std::string>{"adc", "freq", "const"};
+    auto method_choices =
+        std::vector<std::string>{"linear", "linear-window", "therm"};
+    for (auto name : {"map", "iat", "clt", "ego"}) {
+      add_leaf(structure["sensors"], config["sensors"], name, "sensor",
+               make_sensor(config["sensors"].size()), "Sensor input");
+    }
+
+    structure["outputs"] = json::array();
+    config["outputs"] = json::array();
+    for (int i = 0; i < 16; i++) {
+      structure["outputs"].push_back(json{{"_type", "output"}});
+      config["outputs"].push_back(json{
+          {"type", "disabled"}, {"angle", 0.0}, {"pin", i}, {"inverted", 0}});
+    }
+
+    add_leaf(structure["decoder"], config["decoder"], "trigger", "string",
+             "cam-nplusone", "Trigger type",
+             {"cam-nplusone", "even-tooth", "missing-tooth"});
+    add_leaf(structure["decoder"], config["decoder"], "offset", "float", 60.0,
+             "Trigger offset");
+    add_leaf(structure["decoder"], config["decoder"], "max-variance", "float",
+             0.5, "Max variance");
+    add_leaf(structure["decoder"], config["decoder"], "num-triggers",
+             "uint32", 24, "Triggers per cycle");
+    add_leaf(structure["ignition"], config["ignition"], "dwell", "float", 2.5,
+             "Dwell time (ms)");
+    add_leaf(structure["ignition"], config["ignition"], "enabled", "bool",
+             true, "Ignition enabled");
+
+    /* Synthetic leaves for load testing large configurations */
+    if (options.leaves > 0) {
+      structure["bench"] = json::array();
+      config["bench"] = json::array();
+      for (int i = 0; i < options.leaves; i++) {
+        structure["bench"].push_back(
+            json{{"_type", (i % 2) ? "float" : "uint32"},
+                 {"description", "Synthetic leaf"}});
+        config["bench"].push_back((i % 2) ? json(i * 0.5) : json(i));
+      }
+    }
+
+    types = json{
+        {"sensor",
+         {{"source", {{"_type", "string"}, {"choices", sensor_choices}}},
+          {"method", {{"_type", "string"}, {"choices", method_choices}}}}},
+    };
+
+    feed_keys = {"cputime", "rpm", "sensor.map", "sensor.ego"};
+    for (int i = 0; i < options.channels; i++) {
+      feed_keys.push_back("chan." + std::to_string(i));
+    }
+  }
+
+  /* Resolve a request path into the config, or nullptr if it doesn't exist */
+  json *lookup(const json &path) {
+    json *node = &config;
+    for (const auto &p : path) {
+      if (p.is_string() && node->is_object() && node->contains(p)) {
+        node = &(*node)[p.get<std::string>()];
+      } else if (p.is_number_integer() && node->is_array() &&
+                 p.get<size_t>() < node->size()) {
+        node = &(*node)[p.get<size_t>()];
+      } else {
+        return nullptr;
+      }
+    }
+    return node;
+  }
+
+  void handle_request(const json &req) {
+    if (!req.is_object() || !req.contains("method")) {
+      return;
+    }
+    std::string method = req["method"];
+    if (!req.contains("id")) {
+      /* flash and bootloader have no response */
+      std::cerr << "mockecu: " << method << std::endl;
+      return;
+    }
+
+    json response{{"type", "response"}, {"id", req["id"]}};
+    if (method == "ping") {
+      response["response"] = "pong";
+    } else if (method == "structure") {
+      response["response"] = structure;
+      response["types"] = types;
+    } else if ((method == "get") || (method == "set")) {
+      auto node = lookup(req.value("path", json::array()));
+      if (node == nullptr) {
+        response["response"] = nullptr;
+        response["success"] = false;
+      } else {
+        if ((method == "set") && req.contains("value")) {
+          *node = req["value"];
+        }
+        response["response"] = *node;
+      }
+    } else {
+      response["response"] = nullptr;
+      response["success"] = false;
+    }
+    if ((options.drop_responses > 0) &&
+        (rand() < options.drop_responses * RAND_MAX)) {
+      return;
+    }
+    write_message(response);
+  }
+
+  void feed_loop() {
+    auto start = std::chrono::steady_clock::now();
+    auto period = std::chrono::duration<double>(1.0 / options.rate);
+    auto last_description = start - std::chrono::seconds{1};
+    uint64_t sent = 0;
+
+    while (running) {
+      auto now = std::chrono::steady_clock::now();
+      if (now - last_description >= std::chrono::seconds{1}) {
+        write_message(json{{"type", "description"}, {"keys", feed_keys}});
+        last_description = now;
+      }
+
+      /* Send every frame that has come due, so high rates don't depend on
+       * sleep granularity */
+      uint64_t due = (now - start) / period;
+      for (; sent < due; sent++) {
+        if ((options.drop > 0) && (rand() < options.drop * RAND_MAX)) {
+          continue;
+        }
+        double t = sent * period.count();
+        uint32_t cputime = (uint32_t)(uint64_t)(t * 4000000.0);
+        json values = json::array();
+        values.push_back(cputime);
+        values.push_back((uint32_t)(3000 + 2000 * std::sin(t)));
+        values.push_back((float)(100 + 50 * std::sin(t * 0.5)));
+        values.push_back((float)(0.85 + 0.1 * std::sin(t * 3)));
+        for (int i = 0; i < options.channels; i++) {
+          values.push_back((float)(i + std::sin(t + i)));
+        }
+        write_message(json{{"type", "feed"}, {"values", values}});
+      }
+      std::this_thread::sleep_until(start + (sent + 1) * period);
+    }
+  }
+
+  void read_loop() {
+    if (options.transport == Transport::Udp) {
+      std::vector<uint8_t> buf(65536);
+      while (running) {
+        auto len = recv(in_fd, buf.data(), buf.size(), 0);
+        if (len < 0) {
+          /* Feed datagrams sent before a client is listening come back as
+           * a refused connection on the next recv */
+          if ((errno == ECONNREFUSED) || (errno == EINTR)) {
+            continue;
+          }
+          std::cerr << "mockecu: recv: " << strerror(errno) << std::endl;
+          break;
+        }
+        if (len == 0) {
+          continue;
+        }
+        handle_request(json::from_cbor(buf.begin(), buf.begin() + len, true,
+                                       false));
+      }
+    } else {
+      fdistream in{in_fd};
+      while (running) {
+        try {
+          handle_request(json::from_cbor(in, false));
+        } catch (json::parse_error &e) {
+          if (in.fail() || in.eof()) {
+            break;
+          }
+          std::cerr << "mockecu: parse_error: " << e.what() << std::endl;
+        }
+      }
+    }
+    running = false;
+  }
+
+  void open_pty() {
+    int fd = posix_openpt(O_RDWR | O_NOCTTY);
+    if ((fd < 0) || grantpt(fd) || unlockpt(fd)) {
+      throw std::runtime_error{"Failed to open pty"};
+    }
+    /* Hold the slave side open ourselves, so the master doesn't see a hangup
+     * before a client has connected or between clients */
+    int slave_fd = open(ptsname(fd), O_RDWR | O_NOCTTY);
+    struct termios tty;
+    if ((slave_fd >= 0) && (tcgetattr(slave_fd, &tty) == 0)) {
+      cfmakeraw(&tty);
+      tcsetattr(slave_fd, 0, &tty);
+    }
+    std::cerr << "mockecu: listening on " << ptsname(fd) << std::endl;
+    in_fd = out_fd = fd;
+  }
+
+  void open_udp() {
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (fd < 0) {
+      throw std::runtime_error{"Failed to open socket"};
+    }
+
+    struct sockaddr_in sockaddr;
+    sockaddr.sin_family = AF_INET;
+    sockaddr.sin_addr.s_addr = inet_addr("127.0.0.1");
+    sockaddr.sin_port = htons(5555);
+    if (bind(fd, (struct sockaddr *)&sockaddr, sizeof(sockaddr)) < 0) {
+      throw std::runtime_error{"Failed to bind"};
+    }
+
+    sockaddr.sin_port = htons(5556);
+    if (connect(fd, (struct sockaddr *)&sockaddr, sizeof(sockaddr)) < 0) {
+      throw std::runtime_error{"Failed to connect"};
+    }
+    in_fd = out_fd = fd;
+  }
+
+public:
+  MockEcu(MockOptions opts) : options{opts} {
+    build_config();
+    switch (options.transport) {
+    case Transport::Stdio:
+      in_fd = STDIN_FILENO;
+      out_fd = STDOUT_FILENO;
+      break;
+    case Transport::Pty:
+      open_pty();
+      break;
+    case Transport::Udp:
+      open_udp();
+      break;
+    }
+  }
+
+  void run() {
+    running = true;
+    auto feed_thread = std::thread([](MockEcu *m) { m->feed_loop(); }, this);
+    read_loop();
+    feed_thread.join();
+  }
+};
+
+int main(int argc, char *argv[]) {
+  MockOptions options;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "pur:c:l:d:e:")) != -1) {
+    switch (opt) {
+    case 'p':
+      options.transport = Transport::Pty;
+      break;
+    case 'u':
+      options.transport = Transport::Udp;
+      break;
+    case 'r':
+      options.rate = atof(optarg);
+      break;
+    case 'c':
+      options.channels = atoi(optarg);
+      break;
+    case 'l':
+      options.leaves = atoi(optarg);
+      break;
+    case 'd':
+      options.drop = atof(optarg);
+      break;
+    case 'e':
+      options.drop_responses = atof(optarg);
+      break;
+    }
+  }
+
+  if (options.rate <= 0) {
+    options.rate = 1;
+  }
+
+  MockEcu ecu{options};
+  ecu.run();
+  return 0;
+}
@@ -1,8 +1,11 @@
+#include <algorithm>
 #include <chrono>
+#include <cstdio>
 #include <cstdlib>
 #include <exception>
 #include <streambuf>
 
+#include "ConfigCache.h"
 #include "Log.h"
 #include "viaems.h"
 
@@ -40,8 +43,84 @@ calculate_real_time(uint32_t cpu_time,
   return zero_time + ns_since_zero;
 }
 
+void Protocol::count_feed_frame(std::chrono::steady_clock::time_point now) {
+  metrics.feed_frames += 1;
+  feed_window_frames += 1;
+
+  std::chrono::duration<double> window = now - feed_window_start;
+  if (window.count() >= 1.0) {
+    if (feed_window_start != std::chrono::steady_clock::time_point{}) {
+      metrics.feed_fps_current = feed_window_frames / window.count();
+      metrics.feed_fps.Record((uint64_t)(metrics.feed_fps_current + 0.5));
+    }
+    feed_window_start = now;
+    feed_window_frames = 0;
+  }
+}
+
+/* A frame this many expected intervals after the last is a gap. cputime comes
+ * from the target's timer so is regular enough to catch single lost frames */
+static const double feed_gap_threshold = 1.5;
+
+/* This many gaps in a row of about the same length mean the feed rate has
+ * dropped rather than frames being lost */
+static const int feed_relearn_gaps = 8;
+
+/* cputime runs at 4 MHz */
+static const uint32_t cputime_ticks_per_second = 4000000;
+
+void Protocol::detect_feed_gap(uint32_t cputime, FeedTime time, bool rebased) {
+  if (!feed_started) {
+    feed_started = true;
+    last_feed_point = time;
+    return;
+  }
+
+  /* Unsigned subtraction also gives the right delta across a wrap */
+  uint32_t delta = cputime - last_feed_time;
+
+  if (rebased && (delta > cputime_ticks_per_second)) {
+    /* Not a plausible wrap, so the target restarted */
+    m_feed_updates.gaps.push_back(FeedGap{last_feed_point, time, 0});
+    metrics.feed_gaps += 1;
+  } else if ((feed_interval > 0) &&
+             (delta > feed_interval * feed_gap_threshold)) {
+    if ((feed_gap_run > 0) && (delta > feed_gap_interval * 0.75) &&
+        (delta < feed_gap_interval * 1.25)) {
+      feed_gap_run += 1;
+      feed_gap_interval += (delta - feed_gap_interval) / feed_gap_run;
+    } else {
+      feed_gap_run = 1;
+      feed_gap_interval = delta;
+    }
+    if (feed_gap_run >= feed_relearn_gaps) {
+      feed_interval = feed_gap_interval;
+      feed_gap_run = 0;
+    } else {
+      uint32_t lost = (uint32_t)(delta / feed_interval + 0.5) - 1;
+      m_feed_updates.gaps.push_back(FeedGap{last_feed_point, time, lost});
+      metrics.feed_gaps += 1;
+      metrics.lost_feed_samples += lost;
+    }
+  } else if ((feed_interval == 0) || (delta < feed_interval / 2)) {
+    feed_interval = delta;
+    feed_gap_run = 0;
+  } else {
+    feed_gap_run = 0;
+    /* Slow moving average, so that jitter doesn't look like loss */
+    feed_interval += (delta - feed_interval) / 16;
+  }
+
+  metrics.feed_interval_us = feed_interval / (cputime_ticks_per_second / 1e6);
+  last_feed_point = time;
+}
+
 void Protocol::handle_feed_message_from_ems(const json &a) {
+  auto start = std::chrono::steady_clock::now();
+  count_feed_frame(start);
+
   if (a.size() != m_feed_vars.size()) {
+    metrics.dropped_feed_frames += 1;
     return;
   }
   LogPoint update;
@@ -52,13 +131,16 @@ void Protocol::handle_feed_message_from_ems(const json &a) {
     }
   }
   if (i == m_feed_vars.size()) {
+    metrics.dropped_feed_frames += 1;
     return;
   }
   auto cputime = a[i].get<uint32_t>();
-  if (cputime < last_feed_time) {
+  bool rebased = cputime < last_feed_time;
+  if (rebased) {
     zero_time = calculate_zero_point(cputime, std::chrono::system_clock::now());
   }
   update.time = calculate_real_time(cputime, zero_time);
+  detect_feed_gap(cputime, update.time, rebased);
   last_feed_time = cputime;
   for (size_t i = 0; i < a.size(); i++) {
     const json &val = a[i];
@@ -71,6 +153,10 @@ void Protocol::handle_feed_message_from_ems(const json &a) {
     }
   }
   m_feed_updates.points.emplace_back(update);
+
+  auto elapsed = std::chrono::steady_clock::now() - start;
+  metrics.feed_decode_ns.Record(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
 }
 
 static StructureLeaf generate_config_node(const json &entry,
@@ -96,97 +182,320 @@ static StructureLeaf generate_config_node(const json &entry,
   };
 }
 
-static StructureNode generate_structure_node_from_cbor(const json &entry,
-                                                       StructurePath curpath) {
-  if (entry.is_object()) {
-    if (entry.contains("_type")) {
+/* Fills in node handle of tree from entry. Children are allocated as one
+ * block before descending, so that they are contiguous */
+static void fill_structure_node_from_cbor(StructureTree &tree,
+                                          NodeHandle handle, const json &entry,
+                                          StructurePath curpath) {
+  if (entry.is_object() || entry.is_array()) {
+    if (entry.is_object() && entry.contains("_type")) {
       /* This is a leaf node */
-      return StructureNode{generate_config_node(entry, curpath)};
+      tree.nodes[handle].kind = StructureTree::Kind::Leaf;
+      tree.nodes[handle].leaf = tree.leaves.size();
+      tree.leaves.push_back(generate_config_node(entry, curpath));
+      return;
     }
 
-    /* This is actually a map, we should descend */
-    auto result = StructureNode::StructureMap{};
-    for (const auto &map_entry : entry.items()) {
-      StructurePath new_path = curpath;
-      new_path.push_back(map_entry.key());
+    NodeHandle first = tree.nodes.size();
+    tree.nodes.resize(first + entry.size());
+    tree.nodes[handle].kind = entry.is_object() ? StructureTree::Kind::Map
+                                                : StructureTree::Kind::List;
+    tree.nodes[handle].first_child = first;
+    tree.nodes[handle].child_count = entry.size();
 
-      auto child =
-          generate_structure_node_from_cbor(map_entry.value(), new_path);
-      result.insert(
-          std::pair<std::string, StructureNode>(map_entry.key(), child));
-    }
-    return StructureNode{result};
-  } else if (entry.is_array()) {
-    auto result = StructureNode::StructureList{};
+    /* Object items come in key order, which StructureNode::find relies on */
     int index = 0;
-    for (const auto &list_entry : entry) {
+    for (const auto &item : entry.items()) {
       StructurePath new_path = curpath;
-      new_path.push_back(index);
+      if (entry.is_object()) {
+        new_path.push_back(item.key());
+        tree.nodes[first + index].name = item.key();
+      } else {
+        new_path.push_back(index);
+      }
+      fill_structure_node_from_cbor(tree, first + index, item.value(),
+                                    new_path);
       index += 1;
-
-      auto child = generate_structure_node_from_cbor(list_entry, new_path);
-      result.push_back(child);
     }
-    return StructureNode{result};
+    return;
   }
 
-  return StructureNode{StructureLeaf{}};
+  tree.nodes[handle].kind = StructureTree::Kind::Leaf;
+  tree.nodes[handle].leaf = tree.leaves.size();
+  tree.leaves.push_back(StructureLeaf{});
 }
 
-static std::map<std::string, StructureNode>
+static StructureTree generate_structure_tree_from_cbor(const json &entry) {
+  StructureTree tree;
+  fill_structure_node_from_cbor(tree, 0, entry, {});
+  return tree;
+}
+
+static std::map<std::string, StructureTree>
 generate_types_from_cbor(const json &entry) {
   if (!entry.is_object()) {
     return {};
   }
 
-  std::map<std::string, StructureNode> types;
+  std::map<std::string, StructureTree> types;
   for (auto &[name, t] : entry.items()) {
-    types[name] = generate_structure_node_from_cbor(t, {});
+    types[name] = generate_structure_tree_from_cbor(t);
   }
   return types;
 }
 
+std::optional<StructureNode>
+StructureNode::find(const std::string &name) const {
+  if (!is_map()) {
+    return {};
+  }
+  auto first = tree->nodes.begin() + node().first_child;
+  auto last = first + node().child_count;
+  auto it = std::lower_bound(
+      first, last, name,
+      [](const StructureTree::Node &n, const std::string &key) {
+        return n.name < key;
+      });
+  if (it == last || it->name != name) {
+    return {};
+  }
+  return StructureNode{tree, (NodeHandle)(it - tree->nodes.begin())};
+}
+
+size_t StructurePathHash::operator()(const StructurePath &path) const {
+  size_t hash = path.size();
+  for (const auto &p : path) {
+    hash ^= std::hash<std::variant<int, std::string>>{}(p) + 0x9e3779b9 +
+            (hash << 6) + (hash >> 2);
+  }
+  return hash;
+}
+
+PathId PathInterner::intern(const StructurePath &path) {
+  auto [it, inserted] = ids.try_emplace(path, (PathId)paths.size());
+  if (inserted) {
+    paths.push_back(path);
+  }
+  return it->second;
+}
+
+std::optional<PathId> PathInterner::find(const StructurePath &path) const {
+  auto it = ids.find(path);
+  if (it == ids.end()) {
+    return {};
+  }
+  return it->second;
+}
+
+PathId ConfigValues::id(const StructurePath &path) {
+  auto id = interner.intern(path);
+  if (id >= values.size()) {
+    values.resize(id + 1);
+  }
+  return id;
+}
+
+const ConfigValue *ConfigValues::find(const StructurePath &path) const {
+  auto id = interner.find(path);
+  return id ? find(*id) : nullptr;
+}
+
+ConfigValue *ConfigValues::find_mutable(const StructurePath &path) {
+  auto id = interner.find(path);
+  if (!id || !values[*id]) {
+    return nullptr;
+  }
+  return &*values[*id];
+}
+
+void ConfigValues::insert_or_assign(PathId id, ConfigValue value) {
+  if (!values[id]) {
+    count += 1;
+  }
+  values[id] = std::move(value);
+}
+
+void ConfigValues::clear() {
+  /* Ids stay valid, so that an indexed structure can be refilled */
+  for (auto &value : values) {
+    value.reset();
+  }
+  count = 0;
+}
+
+bool ConfigValues::operator==(const ConfigValues &o) const {
+  if (count != o.count) {
+    return false;
+  }
+  for (const auto &[path, value] : *this) {
+    auto other = o.find(path);
+    if (!other || !(*other == value)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+const ConfigValue *ValueSnapshot::find(PathId id) const {
+  if (!chunks || (id / chunk_size >= chunks->size())) {
+    return nullptr;
+  }
+  const auto &chunk = (*chunks)[id / chunk_size];
+  return chunk ? (*chunk)[id % chunk_size].get() : nullptr;
+}
+
+ValueSnapshot ValueSnapshot::assign(PathId id, ConfigValue value) const {
+  auto new_chunks =
+      chunks ? std::make_shared<std::vector<std::shared_ptr<const Chunk>>>(
+                   *chunks)
+             : std::make_shared<std::vector<std::shared_ptr<const Chunk>>>();
+  if (id / chunk_size >= new_chunks->size()) {
+    new_chunks->resize(id / chunk_size + 1);
+  }
+
+  auto &chunk = (*new_chunks)[id / chunk_size];
+  auto new_chunk = chunk ? std::make_shared<Chunk>(*chunk)
+                         : std::make_shared<Chunk>();
+  (*new_chunk)[id % chunk_size] =
+      std::make_shared<const ConfigValue>(std::move(value));
+  chunk = new_chunk;
+
+  ValueSnapshot result;
+  result.chunks = new_chunks;
+  return result;
+}
+
+std::vector<PathId>
+ValueSnapshot::differences(const ValueSnapshot &other) const {
+  std::vector<PathId> ids;
+  if (chunks == other.chunks) {
+    return ids;
+  }
+  size_t count = std::max(chunks ? chunks->size() : 0,
+                          other.chunks ? other.chunks->size() : 0);
+  for (size_t c = 0; c < count; c++) {
+    auto ours = (chunks && c < chunks->size()) ? (*chunks)[c] : nullptr;
+    auto theirs = (other.chunks && c < other.chunks->size())
+                      ? (*other.chunks)[c]
+                      : nullptr;
+    if (ours == theirs) {
+      continue;
+    }
+    for (size_t i = 0; i < chunk_size; i++) {
+      auto a = ours ? (*ours)[i].get() : nullptr;
+      auto b = theirs ? (*theirs)[i].get() : nullptr;
+      if ((a != b) && (!a || !b || !(*a == *b))) {
+        ids.push_back(c * chunk_size + i);
+      }
+    }
+  }
+  return ids;
+}
+
 void TableValue::resize(int R, int C) {
+  if (axis.size() != 2) {
+    C = 1;
+  }
+  if ((R == rows) && (C == cols)) {
+    return;
+  }
+
+  /* New rows and columns start as copies of the last ones */
+  auto resize_labels = [](std::vector<float> &labels, int n) {
+    while ((int)labels.size() < n) {
+      labels.push_back(labels.empty() ? 0 : labels.back());
+    }
+    labels.resize(n);
+  };
   if (axis.size() == 2) {
-    int oldC = axis[0].labels.size();
-    int oldR = axis[1].labels.size();
+    resize_labels(axis[0].labels, C);
+    resize_labels(axis[1].labels, R);
+  } else if (axis.size() == 1) {
+    resize_labels(axis[0].labels, R);
+  }
 
-    while (R > oldR) {
-      axis[1].labels.push_back(axis[1].labels.back());
-      two.push_back(two.back());
-      oldR++;
+  std::vector<float> resized(R * C);
+  if (!data.empty()) {
+    for (int r = 0; r < R; r++) {
+      const float *from = &data[std::min(r, rows - 1) * cols];
+      float *to = &resized[r * C];
+      int copied = std::min(C, cols);
+      std::copy(from, from + copied, to);
+      std::fill(to + copied, to + C, from[cols - 1]);
     }
-    while (R < oldR) {
-      axis[1].labels.pop_back();
-      two.pop_back();
-      oldR--;
+  }
+  data = std::move(resized);
+  rows = R;
+  cols = C;
+}
+
+void TableValue::fill(TableRegion region, float value) {
+  for (int r = region.top; r <= region.bottom; r++) {
+    float *row = &data[r * cols];
+    std::fill(row + region.left, row + region.right + 1, value);
+  }
+}
+
+void TableValue::offset(TableRegion region, float amount) {
+  for (int r = region.top; r <= region.bottom; r++) {
+    float *row = &data[r * cols];
+    for (int c = region.left; c <= region.right; c++) {
+      row[c] += amount;
     }
+  }
+}
 
-    while (C > oldC) {
-      axis[0].labels.push_back(axis[0].labels.back());
-      for (auto &row : two) {
-        row.push_back(row.back());
-      }
-      oldC++;
+void TableValue::scale(TableRegion region, float factor) {
+  for (int r = region.top; r <= region.bottom; r++) {
+    float *row = &data[r * cols];
+    for (int c = region.left; c <= region.right; c++) {
+      row[c] *= factor;
     }
-    while (C < oldC) {
-      axis[0].labels.pop_back();
-      for (auto &row : two) {
-        row.pop_back();
+  }
+}
+
+void TableValue::smooth(TableRegion region) {
+  /* Neighbours are read from the values before smoothing, and only those
+   * inside the table count */
+  const auto before = data;
+  for (int r = region.top; r <= region.bottom; r++) {
+    int r1 = std::max(r - 1, 0);
+    int r2 = std::min(r + 1, rows - 1);
+    for (int c = region.left; c <= region.right; c++) {
+      int c1 = std::max(c - 1, 0);
+      int c2 = std::min(c + 1, cols - 1);
+      float sum = 0;
+      for (int nr = r1; nr <= r2; nr++) {
+        for (int nc = c1; nc <= c2; nc++) {
+          sum += before[nr * cols + nc];
+        }
       }
-      oldC--;
+      at(r, c) = sum / ((r2 - r1 + 1) * (c2 - c1 + 1));
     }
-  } else {
-    int oldR = axis[0].labels.size();
-    while (R > oldR) {
-      axis[0].labels.push_back(axis[0].labels.back());
-      one.push_back(one.back());
-      oldR++;
-    }
-    while (R < oldR) {
-      axis[0].labels.pop_back();
-      one.pop_back();
-      oldR--;
+  }
+}
+
+void TableValue::interpolate(TableRegion region) {
+  int height = region.bottom - region.top;
+  int width = region.right - region.left;
+  auto lerp = [](float a, float b, float t) { return a + (b - a) * t; };
+
+  /* The edges are kept, so cells can be filled in place */
+  for (int r = region.top; r <= region.bottom; r++) {
+    bool inner_row = (r > region.top) && (r < region.bottom);
+    float tr = height ? (float)(r - region.top) / height : 0;
+    for (int c = region.left; c <= region.right; c++) {
+      bool inner_col = (c > region.left) && (c < region.right);
+      float tc = width ? (float)(c - region.left) / width : 0;
+      float across = lerp(at(r, region.left), at(r, region.right), tc);
+      float down = lerp(at(region.top, c), at(region.bottom, c), tr);
+      if (inner_row && inner_col) {
+        at(r, c) = (across + down) / 2;
+      } else if (inner_col && (height == 0)) {
+        at(r, c) = across;
+      } else if (inner_row && (width == 0)) {
+        at(r, c) = down;
+      }
     }
   }
 }
@@ -209,25 +518,31 @@ static ConfigValue generate_table_value_from_cbor(const json &map) {
   if (((map.count("num-axis") > 0) && map["num-axis"] == 1) ||
       map.count("vertical-axis") == 0) {
     table.axis.push_back(generate_table_axis_from_cbor(map["horizontal-axis"]));
+    table.cols = 1;
     for (const auto &datum : map["data"]) {
-      table.one.push_back(datum);
+      table.data.push_back(datum);
     }
+    table.rows = table.data.size();
   } else {
     table.axis.push_back(generate_table_axis_from_cbor(map["horizontal-axis"]));
     table.axis.push_back(generate_table_axis_from_cbor(map["vertical-axis"]));
-    for (const auto &outter : map["data"]) {
-      std::vector<float> values;
-      for (const auto &value : outter) {
-        values.push_back(value);
+    const auto &rows = map["data"];
+    table.rows = rows.size();
+    table.cols = rows.empty() ? 0 : rows[0].size();
+    table.data.reserve(table.rows * table.cols);
+    for (const auto &outter : rows) {
+      /* Every row is taken to be as long as the first */
+      for (int c = 0; c < table.cols; c++) {
+        table.data.push_back(c < (int)outter.size() ? outter[c].get<float>()
+                                                    : 0);
       }
-      table.two.push_back(values);
     }
   }
   return table;
 }
 
 static ConfigValue generate_output_value_from_cbor(const json &map) {
-  OutputValue v;
+  OutputValue v{};
   v.angle = map.at("angle");
   auto inverted = map.at("inverted");
   if (inverted.is_boolean()) {
@@ -241,7 +556,7 @@ static ConfigValue generate_output_value_from_cbor(const json &map) {
 }
 
 static ConfigValue generate_sensor_value_from_cbor(const json &map) {
-  SensorValue v;
+  SensorValue v{};
   v.source = map.at("source");
   v.method = map.at("method");
   v.pin = map.at("pin");
@@ -337,10 +652,15 @@ static json cbor_from_value(const TableValue &v) {
       {"title", v.title},
   };
   if (v.axis.size() == 1) {
-    result["data"] = v.one;
+    result["data"] = v.data;
     result["horizontal-axis"] = cbor_from_table_axis(v.axis[0]);
   } else {
-    result["data"] = v.two;
+    auto rows = json::array();
+    for (int r = 0; r < v.rows; r++) {
+      auto row = v.data.begin() + r * v.cols;
+      rows.push_back(std::vector<float>(row, row + v.cols));
+    }
+    result["data"] = std::move(rows);
     result["horizontal-axis"] = cbor_from_table_axis(v.axis[0]);
     result["vertical-axis"] = cbor_from_table_axis(v.axis[1]);
   }
@@ -388,20 +708,30 @@ static json cbor_from_value(const SensorValue &v) {
   return j;
 }
 
+json viaems::json_from_value(const ConfigValue &value) {
+  return std::visit([](const auto &v) { return cbor_from_value(v); }, value);
+}
+
+ConfigValue viaems::value_from_json(const json &value) {
+  return generate_node_value_from_cbor(value);
+}
+
 void Protocol::handle_response_message_from_ems(const json &msg) {
   const auto &response = msg["response"];
   int id = msg["id"];
 
-  if (m_requests.empty()) {
+  auto req = m_inflight;
+  if (!req || (id != req->id)) {
+    metrics.unmatched_responses += 1;
     return;
   }
-  auto req = m_requests.front();
 
-  if (id != req->id) {
-    return;
-  }
+  metrics.responses += 1;
+  auto rtt = std::chrono::steady_clock::now() - req->sent_time;
+  metrics.request_rtt_us[req->repr.value("method", "unknown")].Record(
+      std::chrono::duration_cast<std::chrono::microseconds>(rtt).count());
 
-  m_requests.pop_front();
+  m_inflight.reset();
   ensure_sent();
 
   if (std::holds_alternative<PingRequest>(req->request)) {
@@ -409,17 +739,19 @@ void Protocol::handle_response_message_from_ems(const json &msg) {
     pingreq.cb(pingreq.ptr);
   } else if (std::holds_alternative<StructureRequest>(req->request)) {
     auto structurereq = std::get<StructureRequest>(req->request);
-    auto c = generate_structure_node_from_cbor(response, {});
+    auto c = generate_structure_tree_from_cbor(response);
     const auto &types = msg["types"];
     auto t = generate_types_from_cbor(types);
-    structurereq.cb(c, t, structurereq.ptr);
+    structurereq.cb(std::move(c), std::move(t), structurereq.ptr);
   } else if (std::holds_alternative<GetRequest>(req->request)) {
     auto getreq = std::get<GetRequest>(req->request);
     auto val = generate_node_value_from_cbor(response);
     getreq.cb(getreq.path, val, getreq.ptr);
   } else if (std::holds_alternative<SetRequest>(req->request)) {
     auto setreq = std::get<SetRequest>(req->request);
-    auto val = generate_node_value_from_cbor(response);
+    bool error = response.is_null() || (msg.value("success", true) == false);
+    auto val = error ? std::nullopt
+                     : std::optional{generate_node_value_from_cbor(response)};
     setreq.cb(setreq.path, val, setreq.ptr);
   }
 }
@@ -427,24 +759,20 @@ void Protocol::handle_response_message_from_ems(const json &msg) {
 void Protocol::NewData() {
   while (const auto &maybe_msg = connection->Read()) {
     const auto &msg = maybe_msg.value();
-    if (!msg.is_object()) {
-      return;
-    }
-
-    if (!msg.contains("type")) {
-      return;
+    if (!msg.is_object() || !msg.contains("type")) {
+      metrics.malformed_messages += 1;
+      continue;
     }
     std::string type = msg["type"];
-    if ((this->trace > 1) ||
-        ((this->trace > 0) && (type != "feed" && type != "description"))) {
-      std::cerr << "recv: " << msg.dump() << std::endl;
+    if (tracer) {
+      tracer->Record(TraceDirection::Recv, trace_type_from_message(type), msg);
     }
 
 #if 0
     if ((msg.contains("success") == 1) && (msg["success"] != true)) {
       std::cerr << "repeating request" << std::endl;
-      m_requests.front()->is_sent = false;
-      ensure_sent();
+      m_inflight->is_sent = false;
+      send(m_inflight);
     }
 #endif
 
@@ -455,11 +783,22 @@ void Protocol::NewData() {
     } else if (type == "response" && msg.contains("id") &&
                msg.contains("response")) {
       handle_response_message_from_ems(msg);
+    } else {
+      metrics.malformed_messages += 1;
     }
   }
 }
 
-std::shared_ptr<Request> Protocol::Structure(structure_cb cb, void *v) {
+ProtocolMetrics Protocol::Metrics() const {
+  auto m = metrics;
+  m.connection = connection->Stats();
+  return m;
+}
+
+void Protocol::ResetMetrics() { metrics = ProtocolMetrics{}; }
+
+std::shared_ptr<Request> Protocol::Structure(structure_cb cb, void *v,
+                                             RequestPriority priority) {
   uint32_t id = rand() % 1024;
 
   auto wire_request = json{
@@ -471,9 +810,10 @@ std::shared_ptr<Request> Protocol::Structure(structure_cb cb, void *v) {
       .id = id,
       .request = StructureRequest{cb, v},
       .repr = wire_request,
+      .priority = priority,
+      .timeout = std::chrono::milliseconds{5000},
   });
-  m_requests.push_back(req);
-  ensure_sent();
+  enqueue(req);
 
   return req;
 }
@@ -490,9 +830,11 @@ std::shared_ptr<Request> Protocol::Ping(ping_cb cb, void *v) {
       .id = id,
       .request = PingRequest{cb, v},
       .repr = wire_request,
+      .priority = RequestPriority::Control,
+      .timeout = std::chrono::milliseconds{500},
+      .retries = 0,
   });
-  m_requests.push_back(req);
-  ensure_sent();
+  enqueue(req);
 
   return req;
 }
@@ -506,7 +848,7 @@ static json cbor_path_from_structure_path(viaems::StructurePath path) {
 }
 
 std::shared_ptr<Request> Protocol::Get(get_cb cb, viaems::StructurePath path,
-                                       void *v) {
+                                       void *v, RequestPriority priority) {
   uint32_t id = rand() % 1024;
 
   auto wire_request = json{
@@ -520,15 +862,16 @@ std::shared_ptr<Request> Protocol::Get(get_cb cb, viaems::StructurePath path,
       .id = id,
       .request = GetRequest{cb, path, v},
       .repr = wire_request,
+      .priority = priority,
   });
-  m_requests.push_back(req);
-  ensure_sent();
+  enqueue(req);
 
   return req;
 }
 
 std::shared_ptr<Request> Protocol::Set(set_cb cb, viaems::StructurePath path,
-                                       viaems::ConfigValue value, void *v) {
+                                       viaems::ConfigValue value, void *v,
+                                       RequestPriority priority) {
   uint32_t id = rand() % 1024;
 
   auto cval = std::visit(
@@ -543,9 +886,9 @@ std::shared_ptr<Request> Protocol::Set(set_cb cb, viaems::StructurePath path,
       .id = id,
       .request = SetRequest{cb, path, value, v},
       .repr = wire_request,
+      .priority = priority,
   });
-  m_requests.push_back(req);
-  ensure_sent();
+  enqueue(req);
 
   return req;
 }
@@ -560,9 +903,14 @@ void Protocol::Flash() {
       .request = FlashRequest{},
       .repr = wire_request,
   });
-  m_requests.push_back(req);
-  ensure_sent();
-  m_requests.clear();
+
+  /* No response follows, and the target stops answering anything queued */
+  m_inflight.reset();
+  for (auto &queue : m_queues) {
+    queue.clear();
+  }
+  send(req);
+  m_inflight.reset();
 }
 
 void Protocol::Bootloader() {
@@ -575,37 +923,133 @@ void Protocol::Bootloader() {
       .request = BootloaderRequest{},
       .repr = wire_request,
   });
-  m_requests.push_back(req);
-  ensure_sent();
-  m_requests.clear();
+
+  /* No response follows, and the target stops answering anything queued */
+  m_inflight.reset();
+  for (auto &queue : m_queues) {
+    queue.clear();
+  }
+  send(req);
+  m_inflight.reset();
 }
 
 bool Protocol::Cancel(std::shared_ptr<Request> request) {
-  for (auto i = m_requests.begin(); i != m_requests.end(); i++) {
-    if ((*i)->id == request->id) {
-      m_requests.erase(i);
-      ensure_sent();
-      return true;
-    }
+  if (m_inflight == request) {
+    /* A late response will no longer match anything */
+    m_inflight.reset();
+    metrics.cancelled_requests += 1;
+    ensure_sent();
+    return true;
+  }
+  /* Search from the back, as bulk cancellation is done newest first */
+  auto &queue = m_queues[(size_t)request->priority];
+  auto i = std::find(queue.rbegin(), queue.rend(), request);
+  if (i == queue.rend()) {
+    return false;
   }
-  return false;
+  queue.erase(std::next(i).base());
+  metrics.cancelled_requests += 1;
+  return true;
 }
 
-void Protocol::ensure_sent() {
-  if (m_requests.empty()) {
+void Protocol::Poll() {
+  if (!m_inflight) {
+    return;
+  }
+  auto now = std::chrono::steady_clock::now();
+  if (now - m_inflight->sent_time < m_inflight->timeout) {
     return;
   }
 
-  auto first = m_requests.front();
-  if (first->is_sent) {
+  if (m_inflight->retries > 0) {
+    m_inflight->retries -= 1;
+    metrics.retried_requests += 1;
+    send(m_inflight);
     return;
   }
-  first->is_sent = true;
 
-  if (this->trace > 0) {
-    std::cerr << "send: " << first->repr << std::endl;
+  metrics.timed_out_requests += 1;
+  auto dropped = m_inflight;
+  m_inflight.reset();
+  if (dropped->failed) {
+    dropped->failed(dropped, dropped->failed_ptr);
+  }
+  ensure_sent();
+}
+
+size_t Protocol::pending_requests() const {
+  size_t total = m_inflight ? 1 : 0;
+  for (const auto &queue : m_queues) {
+    total += queue.size();
+  }
+  return total;
+}
+
+void Protocol::enqueue(std::shared_ptr<Request> req) {
+  req->queued_time = std::chrono::steady_clock::now();
+  m_queues[(size_t)req->priority].push_back(req);
+  metrics.pending_depth.Record(pending_requests());
+  ensure_sent();
+}
+
+std::shared_ptr<Request> Protocol::next_request() {
+  size_t chosen = m_queues.size();
+  for (size_t i = 0; i < m_queues.size(); i++) {
+    if (!m_queues[i].empty()) {
+      chosen = i;
+      break;
+    }
   }
-  this->connection->Write(first->repr);
+  if (chosen == m_queues.size()) {
+    return nullptr;
+  }
+
+  /* Control requests always go first. Otherwise a waiting lower class that
+   * has been passed over too often takes this slot */
+  if (chosen != (size_t)RequestPriority::Control) {
+    for (size_t i = chosen + 1; i < m_queues.size(); i++) {
+      if (!m_queues[i].empty() && (m_skipped[i] >= max_priority_skips)) {
+        chosen = i;
+        break;
+      }
+    }
+    for (size_t i = chosen + 1; i < m_queues.size(); i++) {
+      if (!m_queues[i].empty()) {
+        m_skipped[i] += 1;
+      }
+    }
+  }
+  m_skipped[chosen] = 0;
+
+  auto req = m_queues[chosen].front();
+  m_queues[chosen].pop_front();
+  return req;
+}
+
+void Protocol::send(std::shared_ptr<Request> req) {
+  req->is_sent = true;
+  req->sent_time = std::chrono::steady_clock::now();
+  metrics.requests_sent += 1;
+
+  if (tracer) {
+    tracer->Record(TraceDirection::Send, TraceType::Request, req->repr);
+  }
+  this->connection->Write(req->repr);
+}
+
+void Protocol::ensure_sent() {
+  if (m_inflight) {
+    return;
+  }
+  m_inflight = next_request();
+  if (!m_inflight) {
+    return;
+  }
+
+  send(m_inflight);
+  auto wait = m_inflight->sent_time - m_inflight->queued_time;
+  metrics.request_wait_us[(size_t)m_inflight->priority].Record(
+      std::chrono::duration_cast<std::chrono::microseconds>(wait).count());
 }
 
 void Model::interrogate(interrogation_change_cb cb, void *ptr) {
@@ -616,31 +1060,121 @@ void Model::interrogate(interrogation_change_cb cb, void *ptr) {
   interrogate_cb_ptr = ptr;
 
   /* First clear any ongoing interrogation commands */
-  for (auto r = get_reqs.rbegin(); r != get_reqs.rend(); r++) {
-    protocol->Cancel(*r);
-  }
-  get_reqs.clear();
+  cancel_pending_values();
   config = Configuration{.save_time = std::chrono::system_clock::now(),
                          .name = "autosave"};
   interrogation_state = InterrogationState{.in_progress = true};
+  pending_paths.clear();
+  clear_history();
 
   if (structure_req) {
     protocol->Cancel(structure_req);
     structure_req.reset();
   }
 
-  structure_req = protocol->Structure(handle_model_structure, this);
+  structure_req = protocol->Structure(handle_model_structure, this,
+                                      RequestPriority::Background);
+}
+
+static bool path_has_prefix(const StructurePath &path,
+                            const StructurePath &prefix) {
+  return (path.size() >= prefix.size()) &&
+         std::equal(prefix.begin(), prefix.end(), path.begin());
+}
+
+template <typename M>
+static bool map_has_prefix(const M &map, const StructurePath &prefix) {
+  auto first = map.lower_bound(prefix);
+  return (first != map.end()) && path_has_prefix(first->first, prefix);
+}
+
+void Model::resume_interrogation(interrogation_change_cb cb, void *ptr) {
+  if (!protocol) {
+    return;
+  }
+  bool active =
+      interrogation_state.in_progress || interrogation_state.revalidating;
+  if (!active || !interrogation_state.have_structure) {
+    /* Nothing worth keeping yet */
+    interrogate(cb, ptr);
+    return;
+  }
+  interrogate_cb = cb;
+  interrogate_cb_ptr = ptr;
+
+  cancel_pending_values();
+  request_pending_values();
+}
+
+void Model::prioritize(const StructurePath &prefix) {
+  if (!protocol) {
+    return;
+  }
+  /* Paths sharing a prefix sort together, so the pending ones under it are
+   * a contiguous range */
+  for (auto path = pending_paths.lower_bound(prefix);
+       path != pending_paths.end(); path++) {
+    if (!path_has_prefix(*path, prefix)) {
+      break;
+    }
+    auto req = get_reqs.find(*path);
+    if (req != get_reqs.end()) {
+      if (req->second->is_sent ||
+          (req->second->priority == RequestPriority::Interactive)) {
+        continue;
+      }
+      protocol->Cancel(req->second);
+    }
+    get_reqs[*path] = protocol->Get(handle_model_get, *path, this,
+                                    RequestPriority::Interactive);
+  }
 }
 
 InterrogationState Model::interrogation_status() { return interrogation_state; }
 
 void Model::handle_model_get(StructurePath path, ConfigValue val, void *ptr) {
   Model *model = (Model *)ptr;
-  model->config.values.insert_or_assign(path, val);
-  model->interrogation_state.complete_nodes += 1;
-  if (model->interrogation_state.total_nodes ==
-      model->interrogation_state.complete_nodes) {
-    model->interrogation_state.in_progress = false;
+  if (model->pending_paths.erase(path) == 0) {
+    /* A repeated response, such as to a retried request */
+    return;
+  }
+  model->get_reqs.erase(path);
+
+  /* Values are reported as they arrive, so that a view built from the
+   * structure fills in progressively. When revalidating, only a cached value
+   * that turned out to be stale is a change */
+  auto &state = model->interrogation_state;
+  auto known = model->config.get(path);
+  auto journalled = model->journal.lower_bound(path);
+  if ((journalled != model->journal.end()) &&
+      path_has_prefix(journalled->first, path)) {
+    /* Leave unconfirmed local edits in place */
+    if (journalled->first == path) {
+      journalled->second = val;
+    } else if (std::holds_alternative<TableValue>(val)) {
+      model->merge_journalled_table(path, std::get<TableValue>(val), known);
+    }
+  } else if (!known || !(*known == val)) {
+    model->config.values.insert_or_assign(path, val);
+    if (model->value_cb) {
+      model->value_cb(path, model->value_cb_ptr);
+    }
+  }
+
+  state.complete_nodes = state.total_nodes - model->pending_paths.size();
+  if (model->pending_paths.empty()) {
+    state.in_progress = false;
+    state.revalidating = false;
+    /* Every value is now known from the target, including cached ones that
+     * were never reported as a change */
+    if (model->confirmed_cb) {
+      for (const auto &leaf : model->config.structure.leaves) {
+        model->confirmed_cb(leaf.path, model->confirmed_cb_ptr);
+      }
+    }
+    if (model->cache) {
+      model->cache->Store(model->config);
+    }
   }
   if (model->interrogate_cb != nullptr) {
     model->interrogate_cb(model->interrogation_status(),
@@ -648,47 +1182,332 @@ void Model::handle_model_get(StructurePath path, ConfigValue val, void *ptr) {
   }
 }
 
-void Model::handle_model_set(StructurePath path, ConfigValue val, void *ptr) {
+/* Only elements of the table have unconfirmed edits, so take the fetched
+ * table with those elements kept at their local values, and record the
+ * fetched ones as what the target has */
+void Model::merge_journalled_table(const StructurePath &path,
+                                   TableValue fetched,
+                                   const std::optional<ConfigValue> &known) {
+  const TableValue *local = nullptr;
+  if (known && std::holds_alternative<TableValue>(*known)) {
+    local = &std::get<TableValue>(*known);
+  }
+  bool same_shape = local && (fetched.rows == local->rows) &&
+                    (fetched.cols == local->cols);
+  auto entry = journal.lower_bound(path);
+  while ((entry != journal.end()) && path_has_prefix(entry->first, path)) {
+    if (!same_shape) {
+      /* The edits no longer fit what is shown of the table */
+      entry = journal.erase(entry);
+      continue;
+    }
+    int row = std::get<int>(entry->first[path.size() + 1]);
+    int col = (entry->first.size() - path.size() == 3)
+                  ? std::get<int>(entry->first.back())
+                  : 0;
+    entry->second = fetched.at(row, col);
+    fetched.at(row, col) = local->at(row, col);
+    entry++;
+  }
+  if (!local || !(*local == fetched)) {
+    config.values.insert_or_assign(path, fetched);
+    if (value_cb) {
+      value_cb(path, value_cb_ptr);
+    }
+  }
+}
+
+/* A table element is addressed by the table's path followed by "data" and
+ * the element's row, and column for two axis tables */
+static StructurePath table_element_path(StructurePath path,
+                                        const TableValue &table, int row,
+                                        int col) {
+  path.push_back(std::string{"data"});
+  path.push_back(row);
+  if (table.axis.size() == 2) {
+    path.push_back(col);
+  }
+  return path;
+}
+
+std::optional<StructurePath>
+Model::element_table_path(const StructurePath &path) const {
+  for (size_t depth : {2, 3}) {
+    if (path.size() <= depth) {
+      continue;
+    }
+    StructurePath table_path{path.begin(), path.end() - depth};
+    auto data = path[table_path.size()];
+    if (!std::holds_alternative<std::string>(data) ||
+        (std::get<std::string>(data) != "data")) {
+      continue;
+    }
+    auto table = config.find(table_path);
+    if (table && std::holds_alternative<TableValue>(*table) &&
+        (std::get<TableValue>(*table).axis.size() == depth - 1)) {
+      return table_path;
+    }
+  }
+  return {};
+}
+
+bool Model::has_pending_writes(const StructurePath &prefix) const {
+  return map_has_prefix(set_reqs, prefix) ||
+         map_has_prefix(debounced_sets, prefix);
+}
+
+void Model::handle_model_set(StructurePath path,
+                             std::optional<ConfigValue> val, void *ptr) {
   Model *model = (Model *)ptr;
-  model->config.values.insert_or_assign(path, val);
-  if (model->value_cb) {
-    model->value_cb(path, model->value_cb_ptr);
+
+  std::shared_ptr<Request> sent;
+  auto req = model->set_reqs.find(path);
+  if ((req != model->set_reqs.end()) && req->second->is_sent) {
+    sent = req->second;
+    model->set_reqs.erase(req);
+  }
+
+  /* A target may echo a whole number element as an integer */
+  auto table_path = model->element_table_path(path);
+  if (table_path && val && std::holds_alternative<uint32_t>(*val)) {
+    val = (float)std::get<uint32_t>(*val);
+  }
+  if (table_path && (!val || !std::holds_alternative<float>(*val))) {
+    model->handle_rejected_element_write(*table_path, path, sent);
+  } else if (!val) {
+    model->abandon_write(path);
+  } else {
+    model->confirm_write(path, *val);
+    model->report_confirmed(table_path ? *table_path : path);
   }
+  model->finish_upload(path);
 }
 
-static std::vector<StructurePath>
-enumerate_structure_paths(StructureNode node) {
-  std::vector<StructurePath> paths;
-  if (node.is_leaf()) {
-    auto leaf = node.leaf();
-    paths.push_back(leaf.path);
-  } else if (node.is_map()) {
-    for (auto child : node.map()) {
-      auto subs = enumerate_structure_paths(child.second);
-      paths.insert(paths.end(), subs.begin(), subs.end());
+/* The protocol gave up on a write, so it will never be confirmed */
+void Model::handle_model_set_failed(std::shared_ptr<Request> req, void *ptr) {
+  Model *model = (Model *)ptr;
+  auto path = std::get<SetRequest>(req->request).path;
+  auto req_entry = model->set_reqs.find(path);
+  if ((req_entry != model->set_reqs.end()) && (req_entry->second == req)) {
+    model->set_reqs.erase(req_entry);
+  }
+  model->finish_upload(path);
+  model->abandon_write(path);
+}
+
+/* Undo the local edit of a write the target never took */
+void Model::abandon_write(const StructurePath &path) {
+  auto entry = journal.find(path);
+  if ((entry == journal.end()) || has_pending_writes(path)) {
+    return;
+  }
+  auto confirmed = entry->second;
+  journal.erase(entry);
+  if (confirmed) {
+    roll_back(path, *confirmed);
+    auto table_path = element_table_path(path);
+    report_confirmed(table_path ? *table_path : path);
+  }
+}
+
+bool Model::has_unconfirmed_edits(const StructurePath &prefix) const {
+  return map_has_prefix(journal, prefix) || has_pending_writes(prefix);
+}
+
+void Model::report_confirmed(const StructurePath &path) {
+  if (confirmed_cb) {
+    confirmed_cb(path, confirmed_cb_ptr);
+  }
+}
+
+std::optional<ConfigValue>
+Model::confirmed_value(const StructurePath &path) const {
+  auto value = config.get(path);
+  for (auto entry = journal.lower_bound(path);
+       (entry != journal.end()) && path_has_prefix(entry->first, path);
+       entry++) {
+    if (entry->first == path) {
+      return entry->second;
+    }
+    /* An element of the table, of which the target has the journalled value
+     * rather than the shown one */
+    if (!value || !entry->second ||
+        !std::holds_alternative<TableValue>(*value) ||
+        !std::holds_alternative<float>(*entry->second)) {
+      continue;
+    }
+    auto &table = std::get<TableValue>(*value);
+    int row = std::get<int>(entry->first[path.size() + 1]);
+    int col = (entry->first.size() - path.size() == 3)
+                  ? std::get<int>(entry->first.back())
+                  : 0;
+    if ((row < table.rows) && (col < table.cols)) {
+      table.at(row, col) = std::get<float>(*entry->second);
+    }
+  }
+  return value;
+}
+
+std::optional<ConfigValue> Model::current_value(const StructurePath &path) {
+  auto table_path = element_table_path(path);
+  if (!table_path) {
+    return config.get(path);
+  }
+  const auto &table = std::get<TableValue>(*config.find(*table_path));
+  int row = std::get<int>(path[table_path->size() + 1]);
+  int col = (table.axis.size() == 2) ? std::get<int>(path.back()) : 0;
+  return table.at(row, col);
+}
+
+void Model::store_value(const StructurePath &path, const ConfigValue &val) {
+  auto table_path = element_table_path(path);
+  if (!table_path) {
+    config.values.insert_or_assign(path, val);
+    return;
+  }
+  if (!std::holds_alternative<float>(val)) {
+    return;
+  }
+  auto &table =
+      std::get<TableValue>(*config.values.find_mutable(*table_path));
+  int row = std::get<int>(path[table_path->size() + 1]);
+  int col = (table.axis.size() == 2) ? std::get<int>(path.back()) : 0;
+  table.at(row, col) = std::get<float>(val);
+}
+
+void Model::confirm_write(const StructurePath &path, const ConfigValue &val) {
+  /* Element writes are reported as a change of their table */
+  auto table_path = element_table_path(path);
+  auto changed = table_path ? *table_path : path;
+
+  auto entry = journal.find(path);
+  if (entry == journal.end()) {
+    /* Don't revert a widget to this value while a newer edit of it is still
+     * waiting to be sent */
+    if (has_pending_writes(changed)) {
+      if (!optimistic) {
+        store_value(path, val);
+      }
+      return;
+    }
+    store_value(path, val);
+    if (value_cb) {
+      value_cb(changed, value_cb_ptr);
     }
+    return;
+  }
 
-  } else if (node.is_list()) {
-    for (auto child : node.list()) {
-      auto subs = enumerate_structure_paths(child);
-      paths.insert(paths.end(), subs.begin(), subs.end());
+  if (has_pending_writes(path)) {
+    /* Only the latest the target has confirmed, a newer edit is on its way */
+    entry->second = val;
+    return;
+  }
+  auto expected = current_value(path);
+  journal.erase(entry);
+  if (expected && (*expected == val)) {
+    if (value_cb && !has_pending_writes(changed)) {
+      value_cb(changed, value_cb_ptr);
     }
+    return;
+  }
+  roll_back(path, val);
+}
+
+void Model::roll_back(const StructurePath &path, const ConfigValue &val) {
+  auto table_path = element_table_path(path);
+  auto changed = table_path ? *table_path : path;
+  store_value(path, val);
+  if (value_cb) {
+    value_cb(changed, value_cb_ptr);
+  }
+  if (rollback_cb) {
+    rollback_cb(changed, rollback_cb_ptr);
+  }
+}
+
+void Model::handle_rejected_element_write(const StructurePath &table_path,
+                                          const StructurePath &path,
+                                          std::shared_ptr<Request> sent) {
+  /* The target doesn't take element writes, so write the whole table
+   * instead, including this element, from now on */
+  element_writes = false;
+  if (!sent) {
+    return;
+  }
+  auto table = std::get<TableValue>(*config.get(table_path));
+  int row = std::get<int>(path[table_path.size() + 1]);
+  int col = (table.axis.size() == 2) ? std::get<int>(path.back()) : 0;
+
+  auto pending = debounced_sets.find(table_path);
+  if (pending != debounced_sets.end()) {
+    table = std::get<TableValue>(pending->second.value);
+  }
+  auto value = std::get<SetRequest>(sent->request).val;
+  table.at(row, col) = std::get<float>(value);
+  if (upload_paths.count(path) == 0) {
+    write_value(table_path, table);
+  } else if (upload_paths.insert(table_path).second) {
+    /* The upload isn't done until the table is written */
+    upload_state.total += 1;
+    send_set(table_path, table, RequestPriority::Background);
+  }
+}
+
+static std::vector<StructurePath>
+enumerate_structure_paths(const StructureTree &tree) {
+  std::vector<StructurePath> paths;
+  paths.reserve(tree.leaves.size());
+  for (const auto &leaf : tree.leaves) {
+    paths.push_back(leaf.path);
   }
   return paths;
 }
 
-void Model::handle_model_structure(StructureNode root,
-                                   std::map<std::string, StructureNode> types,
+void Model::request_pending_values() {
+  for (const auto &path : pending_paths) {
+    get_reqs[path] = protocol->Get(handle_model_get, path, this,
+                                   RequestPriority::Background);
+  }
+}
+
+void Model::cancel_pending_values() {
+  /* In reverse, as the later paths were queued last */
+  for (auto r = get_reqs.rbegin(); r != get_reqs.rend(); r++) {
+    protocol->Cancel(r->second);
+  }
+  get_reqs.clear();
+}
+
+void Model::handle_model_structure(StructureTree root,
+                                   std::map<std::string, StructureTree> types,
                                    void *ptr) {
   Model *model = (Model *)ptr;
-  model->config.structure = root;
-  model->config.types = types;
-  auto paths = enumerate_structure_paths(root);
+  model->config.structure = std::move(root);
+  model->config.types = std::move(types);
+  model->config.index_structure();
+  model->interrogation_state.have_structure = true;
+  model->structure_req.reset();
+  auto paths = enumerate_structure_paths(model->config.structure);
+  model->pending_paths = std::set<StructurePath>(paths.begin(), paths.end());
   model->interrogation_state.total_nodes = paths.size();
-  for (const auto &path : paths) {
-    model->get_reqs.push_back(
-        model->protocol->Get(handle_model_get, path, model));
+
+  /* A known firmware build shows its last known values straight away, and
+   * then has them read back in the background */
+  auto cached = model->cache
+                    ? model->cache->Load(model->config.fingerprint())
+                    : std::nullopt;
+  if (cached) {
+    for (const auto &[path, value] : cached->values) {
+      model->config.values.insert_or_assign(path, value);
+    }
+    model->interrogation_state.in_progress = false;
+    model->interrogation_state.revalidating = true;
+  }
+  if (paths.empty()) {
+    model->interrogation_state.in_progress = false;
+    model->interrogation_state.revalidating = false;
   }
+  model->request_pending_values();
   if (model->interrogate_cb != nullptr) {
     model->interrogate_cb(model->interrogation_status(),
                           model->interrogate_cb_ptr);
@@ -699,29 +1518,331 @@ void Model::set_value(StructurePath path, ConfigValue value) {
   if (!protocol) {
     return;
   }
-  protocol->Set(handle_model_set, path, value, this);
+  auto table_path = element_table_path(path);
+  if (!table_path) {
+    record_edit(path, value);
+  } else if (std::holds_alternative<float>(value)) {
+    /* History holds whole values, so an element edit is kept as its table */
+    auto table = edited_value(*table_path);
+    if (table) {
+      int row = std::get<int>(path[table_path->size() + 1]);
+      int col = (path.size() - table_path->size() == 3)
+                    ? std::get<int>(path.back())
+                    : 0;
+      std::get<TableValue>(*table).at(row, col) = std::get<float>(value);
+      record_edit(*table_path, *table);
+    }
+  }
+  write_value(path, value);
+}
+
+void Model::write_value(const StructurePath &path, const ConfigValue &value) {
+  auto now = std::chrono::steady_clock::now();
+  if (std::holds_alternative<TableValue>(value)) {
+    /* A whole table includes any of its elements still waiting */
+    auto set = debounced_sets.upper_bound(path);
+    while ((set != debounced_sets.end()) &&
+           path_has_prefix(set->first, path)) {
+      set = debounced_sets.erase(set);
+    }
+  }
+  if (optimistic) {
+    journal_write(path, value);
+  }
+  auto pending = debounced_sets.find(path);
+  if (pending == debounced_sets.end()) {
+    debounced_sets.emplace(path, DebouncedSet{value, now, now});
+  } else {
+    pending->second.value = value;
+    pending->second.last_edit = now;
+  }
+}
+
+void Model::journal_write(const StructurePath &path, const ConfigValue &value) {
+  auto confirmed = current_value(path);
+  if (confirmed && std::holds_alternative<TableValue>(value)) {
+    /* Fold in the journal entries of the table's elements, as the whole
+     * table write replaces theirs */
+    auto &table = std::get<TableValue>(*confirmed);
+    auto entry = journal.upper_bound(path);
+    while ((entry != journal.end()) && path_has_prefix(entry->first, path)) {
+      if (entry->second && std::holds_alternative<float>(*entry->second)) {
+        int row = std::get<int>(entry->first[path.size() + 1]);
+        int col =
+            (table.axis.size() == 2) ? std::get<int>(entry->first.back()) : 0;
+        table.at(row, col) = std::get<float>(*entry->second);
+      }
+      entry = journal.erase(entry);
+    }
+  }
+
+  /* The entry keeps the last confirmed value until the target answers */
+  journal.emplace(path, confirmed);
+  store_value(path, value);
+}
+
+static size_t table_size(const TableValue &table) {
+  return table.data.size();
+}
+
+/* Past a quarter of the table one whole table write is cheaper than writing
+ * the cells individually */
+static bool prefer_whole_table(const TableValue &table, size_t cells) {
+  return (cells == 0) || (cells * 4 > table_size(table));
+}
+
+/* The cells that differ between two tables of the same shape, or nothing if
+ * anything but the cells differs */
+static std::optional<std::set<std::pair<int, int>>>
+changed_table_cells(const TableValue &from, const TableValue &to) {
+  if ((from.title != to.title) || !(from.axis == to.axis) ||
+      (from.rows != to.rows) || (from.cols != to.cols)) {
+    return {};
+  }
+  std::set<std::pair<int, int>> cells;
+  for (size_t i = 0; i < to.data.size(); i++) {
+    if (from.data[i] != to.data[i]) {
+      cells.insert(std::make_pair(i / to.cols, i % to.cols));
+    }
+  }
+  return cells;
+}
+
+void Model::set_table_cells(const StructurePath &path, const TableValue &table,
+                            const std::set<std::pair<int, int>> &cells) {
+  if (!protocol) {
+    return;
+  }
+  record_edit(path, table);
+  write_table_cells(path, table, cells);
+}
+
+void Model::write_table_cells(const StructurePath &path,
+                              const TableValue &table,
+                              const std::set<std::pair<int, int>> &cells) {
+  /* With a whole table write already waiting, update that instead */
+  if (!element_writes || prefer_whole_table(table, cells.size()) ||
+      (debounced_sets.count(path) != 0)) {
+    write_value(path, table);
+    return;
+  }
+  for (const auto &[row, col] : cells) {
+    write_value(table_element_path(path, table, row, col), table.at(row, col));
+  }
+}
+
+/* The value of path including edits not yet confirmed */
+std::optional<ConfigValue> Model::edited_value(const StructurePath &path) {
+  auto id = history_paths.find(path);
+  const auto *edited = id ? history[history_pos].find(*id) : nullptr;
+  if (edited) {
+    return *edited;
+  }
+  return config.get(path);
+}
+
+void Model::record_edit(const StructurePath &path, const ConfigValue &value) {
+  const auto *before = config.find(path);
+  if (!before) {
+    return;
+  }
+  auto id = history_paths.intern(path);
+  edited_from.emplace(id, *before);
+
+  /* A new edit replaces anything that was undone */
+  history.resize(history_pos + 1);
+  history.push_back(history[history_pos].assign(id, value));
+  history_pos += 1;
+}
+
+void Model::restore(const ValueSnapshot &from, const ValueSnapshot &to) {
+  for (auto id : from.differences(to)) {
+    const auto &path = history_paths.path(id);
+    const auto *shown = from.find(id);
+    const auto *target = to.find(id);
+    const auto &old_value = shown ? *shown : edited_from.at(id);
+    const auto &value = target ? *target : edited_from.at(id);
+
+    /* Tables of the same shape only need their changed cells written */
+    std::optional<std::set<std::pair<int, int>>> cells;
+    if (std::holds_alternative<TableValue>(value) &&
+        std::holds_alternative<TableValue>(old_value)) {
+      cells = changed_table_cells(std::get<TableValue>(old_value),
+                                  std::get<TableValue>(value));
+    }
+    if (cells) {
+      write_table_cells(path, std::get<TableValue>(value), *cells);
+    } else {
+      write_value(path, value);
+    }
+
+    /* Otherwise shown once the target confirms it */
+    if (optimistic && value_cb) {
+      value_cb(path, value_cb_ptr);
+    }
+  }
+}
+
+void Model::clear_history() {
+  history.assign(1, ValueSnapshot{});
+  history_pos = 0;
+  edited_from.clear();
+}
+
+bool Model::undo() {
+  if (!protocol || !can_undo()) {
+    return false;
+  }
+  history_pos -= 1;
+  restore(history[history_pos + 1], history[history_pos]);
+  return true;
+}
+
+bool Model::redo() {
+  if (!protocol || !can_redo()) {
+    return false;
+  }
+  history_pos += 1;
+  restore(history[history_pos - 1], history[history_pos]);
+  return true;
+}
+
+void Model::upload(const Configuration &conf, upload_change_cb cb, void *ptr) {
+  if (!protocol) {
+    return;
+  }
+  upload_cb = cb;
+  upload_cb_ptr = ptr;
+  upload_paths.clear();
+  clear_history();
+
+  /* Only what differs from the target is written. Paths the target doesn't
+   * have are skipped, as are unchanged values */
+  std::vector<std::pair<StructurePath, ConfigValue>> writes;
+  for (const auto &[path, value] : conf.values) {
+    auto current = config.get(path);
+    if (!current || (*current == value)) {
+      continue;
+    }
+    if (std::holds_alternative<TableValue>(value) &&
+        std::holds_alternative<TableValue>(*current)) {
+      const auto &table = std::get<TableValue>(value);
+      auto cells = changed_table_cells(std::get<TableValue>(*current), table);
+      if (element_writes && cells &&
+          !prefer_whole_table(table, cells->size())) {
+        for (const auto &[row, col] : *cells) {
+          writes.push_back(
+              std::make_pair(table_element_path(path, table, row, col),
+                             table.at(row, col)));
+        }
+        continue;
+      }
+    }
+    writes.push_back(std::make_pair(path, value));
+  }
+
+  /* Everything is queued at once, so that each write goes out as soon as the
+   * previous one is answered */
+  upload_state = UploadState{.in_progress = !writes.empty(),
+                             .total = (int)writes.size(),
+                             .complete = 0};
+  for (const auto &[path, value] : writes) {
+    debounced_sets.erase(path);
+    upload_paths.insert(path);
+    send_set(path, value, RequestPriority::Background);
+  }
+  if (upload_cb) {
+    upload_cb(upload_state, upload_cb_ptr);
+  }
+}
+
+void Model::finish_upload(const StructurePath &path) {
+  if (upload_paths.erase(path) == 0) {
+    return;
+  }
+  upload_state.complete = upload_state.total - upload_paths.size();
+  upload_state.in_progress = !upload_paths.empty();
+  if (upload_cb) {
+    upload_cb(upload_state, upload_cb_ptr);
+  }
+}
+
+void Model::send_set(const StructurePath &path, const ConfigValue &value,
+                     RequestPriority priority) {
+  /* A queued set of the same path is out of date, replace it rather than
+   * sending both */
+  auto queued = set_reqs.find(path);
+  if ((queued != set_reqs.end()) && !queued->second->is_sent) {
+    protocol->Cancel(queued->second);
+  }
+
+  /* As are queued writes of elements of a table being written whole */
+  if (std::holds_alternative<TableValue>(value)) {
+    auto element = set_reqs.upper_bound(path);
+    while ((element != set_reqs.end()) &&
+           path_has_prefix(element->first, path)) {
+      if (element->second->is_sent) {
+        element++;
+        continue;
+      }
+      protocol->Cancel(element->second);
+      finish_upload(element->first);
+      element = set_reqs.erase(element);
+    }
+  }
+  auto req = protocol->Set(handle_model_set, path, value, this, priority);
+  req->failed = handle_model_set_failed;
+  req->failed_ptr = this;
+  set_reqs[path] = req;
+}
+
+void Model::poll() {
+  if (!protocol) {
+    debounced_sets.clear();
+    return;
+  }
+  auto now = std::chrono::steady_clock::now();
+  for (auto set = debounced_sets.begin(); set != debounced_sets.end();) {
+    bool settled = (now - set->second.last_edit) >= set_debounce;
+    bool overdue = (now - set->second.first_edit) >= set_max_delay;
+    if (settled || overdue) {
+      send_set(set->first, set->second.value);
+      set = debounced_sets.erase(set);
+    } else {
+      set++;
+    }
+  }
 }
 
 void Model::set_configuration(const Configuration &conf) {
   config = conf;
+  clear_history();
   if (interrogate_cb != nullptr) {
     interrogate_cb(interrogation_status(), interrogate_cb_ptr);
   }
 }
 
-void Model::set_protocol(std::shared_ptr<Protocol> proto) { protocol = proto; }
+void Model::set_protocol(std::shared_ptr<Protocol> proto) {
+  protocol = proto;
+  set_reqs.clear();
+  debounced_sets.clear();
+  upload_paths.clear();
+  upload_state = UploadState{};
+  journal.clear();
+  clear_history();
+}
 
 static json json_config_from_structure(StructureNode n,
                                        const Configuration &conf) {
   json j{};
   if (n.is_list()) {
-    for (const auto &v : n.list()) {
+    for (auto v : n) {
       j.push_back(json_config_from_structure(v, conf));
     }
     return j;
   } else if (n.is_map()) {
-    for (const auto &v : n.map()) {
-      j[v.first] = json_config_from_structure(v.second, conf);
+    for (auto v : n) {
+      j[v.name()] = json_config_from_structure(v, conf);
     }
     return j;
   } else {
@@ -733,17 +1854,17 @@ static json json_config_from_structure(StructureNode n,
 static json json_structure_from_structure(StructureNode n) {
   json j{};
   if (n.is_list()) {
-    for (const auto &v : n.list()) {
+    for (auto v : n) {
       j.push_back(json_structure_from_structure(v));
     }
     return j;
   } else if (n.is_map()) {
-    for (const auto &v : n.map()) {
-      j[v.first] = json_structure_from_structure(v.second);
+    for (auto v : n) {
+      j[v.name()] = json_structure_from_structure(v);
     }
     return j;
   } else {
-    auto leaf = n.leaf();
+    const auto &leaf = n.leaf();
     return {
         {"_type", leaf.type},
         {"description", leaf.description},
@@ -753,11 +1874,11 @@ static json json_structure_from_structure(StructureNode n) {
 }
 
 json Configuration::to_json() const {
-  auto config = json_config_from_structure(structure, *this);
-  auto s = json_structure_from_structure(structure);
+  auto config = json_config_from_structure(structure.root(), *this);
+  auto s = json_structure_from_structure(structure.root());
   json jsontypes;
   for (auto &[name, type] : types) {
-    jsontypes[name] = json_structure_from_structure(type);
+    jsontypes[name] = json_structure_from_structure(type.root());
   }
 
   return {
@@ -767,32 +1888,214 @@ json Configuration::to_json() const {
   };
 }
 
+std::string viaems::fnv1a_hex(const uint8_t *data, size_t len) {
+  uint64_t hash = 0xcbf29ce484222325;
+  for (size_t i = 0; i < len; i++) {
+    hash ^= data[i];
+    hash *= 0x100000001b3;
+  }
+
+  char hex[17];
+  snprintf(hex, sizeof(hex), "%016llx", (unsigned long long)hash);
+  return hex;
+}
+
+std::string Configuration::fingerprint() const {
+  json j = {
+      {"structure", json_structure_from_structure(structure.root())},
+      {"types", json::object()},
+  };
+  for (auto &[name, type] : types) {
+    j["types"][name] = json_structure_from_structure(type.root());
+  }
+
+  auto cbor = json::to_cbor(j);
+  return fnv1a_hex(cbor.data(), cbor.size());
+}
+
+void Configuration::index_structure() {
+  for (auto &leaf : structure.leaves) {
+    leaf.id = values.id(leaf.path);
+  }
+}
+
+/* Walks the structure and its config json together, so each value is found
+ * by one step down from its parent */
+static void load_config_values(StructureNode n, const json &config,
+                               ConfigValues &values) {
+  if (n.is_leaf()) {
+    const auto &leaf = n.leaf();
+    try {
+      values.insert_or_assign(leaf.id, generate_node_value_from_cbor(config));
+    } catch (json::exception &e) {
+      std::cerr << "Unable to parse config value: " << config << std::endl;
+    }
+  } else if (n.is_map()) {
+    if (!config.is_object()) {
+      std::cerr << "Config value is not a map: " << config << std::endl;
+      return;
+    }
+    for (auto child : n) {
+      auto entry = config.find(child.name());
+      if (entry == config.end()) {
+        std::cerr << "Config value missing: " << child.name() << std::endl;
+        continue;
+      }
+      load_config_values(child, *entry, values);
+    }
+  } else if (n.is_list()) {
+    if (!config.is_array() || (config.size() != n.size())) {
+      std::cerr << "Config value is not a list of " << n.size() << ": "
+                << config << std::endl;
+      return;
+    }
+    for (size_t i = 0; i < n.size(); i++) {
+      load_config_values(n.child(i), config[i], values);
+    }
+  }
+}
+
 void Configuration::from_json(const json &j) {
-  auto structure = generate_structure_node_from_cbor(j.at("structure"), {});
-  this->structure = structure;
+  structure = generate_structure_tree_from_cbor(j.at("structure"));
   values.clear();
+  index_structure();
+
+  types = generate_types_from_cbor(j.at("types"));
+
+  load_config_values(structure.root(), j.at("config"), values);
+}
 
-  types.clear();
-  for (auto &[name, jsontype] : j.at("types").items()) {
-    auto type = generate_structure_node_from_cbor(jsontype, {});
-    types[name] = type;
+/* Writes json text as it walks, rather than building the whole document
+ * first. Output matches json::dump with the same indent */
+class JsonStreamWriter {
+  std::ostream &out;
+  int indent;
+  std::vector<bool> empty;
+
+  void newline() {
+    if (indent >= 0) {
+      out << '\n' << std::string(empty.size() * indent, ' ');
+    }
   }
 
-  auto paths = enumerate_structure_paths(structure);
-  for (const auto &path : paths) {
-    json val = j["config"];
-    for (const auto &p : path) {
-      if (std::holds_alternative<std::string>(p)) {
-        val = val.at(std::get<std::string>(p));
-      } else {
-        val = val.at(std::get<int>(p));
+  void element() {
+    if (!empty.back()) {
+      out << ',';
+    }
+    empty.back() = false;
+    newline();
+  }
+
+public:
+  JsonStreamWriter(std::ostream &out, int indent) : out{out}, indent{indent} {}
+
+  void begin(char open) {
+    out << open;
+    empty.push_back(true);
+  }
+
+  void end(char close) {
+    bool was_empty = empty.back();
+    empty.pop_back();
+    if (!was_empty) {
+      newline();
+    }
+    out << close;
+  }
+
+  void key(const std::string &k) {
+    element();
+    out << json(k).dump() << (indent >= 0 ? ": " : ":");
+  }
+
+  void item() { element(); }
+
+  /* A complete value, indented to the current depth */
+  void value(const json &v) {
+    std::string text = v.dump(indent);
+    if (indent < 0 || empty.empty()) {
+      out << text;
+      return;
+    }
+    /* Newlines only occur between tokens, strings have them escaped */
+    std::string pad(empty.size() * indent, ' ');
+    for (char c : text) {
+      out << c;
+      if (c == '\n') {
+        out << pad;
       }
     }
-    try {
-      auto value = generate_node_value_from_cbor(val);
-      values.insert_or_assign(path, value);
-    } catch (nlohmann::detail::out_of_range &e) {
-      std::cerr << "Unable to parse config value: " << val << std::endl;
+  }
+};
+
+static void write_config_json(JsonStreamWriter &w, StructureNode n,
+                              const Configuration &conf) {
+  if (n.is_leaf()) {
+    const auto *val = conf.find(n.leaf().id);
+    w.value(val ? std::visit([](const auto &v) { return cbor_from_value(v); },
+                             *val)
+                : json(uint32_t{0}));
+    return;
+  }
+  if (n.size() == 0) {
+    w.value(nullptr);
+    return;
+  }
+  w.begin(n.is_map() ? '{' : '[');
+  for (auto child : n) {
+    if (n.is_map()) {
+      w.key(child.name());
+    } else {
+      w.item();
+    }
+    write_config_json(w, child, conf);
+  }
+  w.end(n.is_map() ? '}' : ']');
+}
+
+static void write_structure_json(JsonStreamWriter &w, StructureNode n) {
+  if (n.is_leaf()) {
+    const auto &leaf = n.leaf();
+    w.value({
+        {"_type", leaf.type},
+        {"description", leaf.description},
+        {"choices", leaf.choices},
+    });
+    return;
+  }
+  if (n.size() == 0) {
+    w.value(nullptr);
+    return;
+  }
+  w.begin(n.is_map() ? '{' : '[');
+  for (auto child : n) {
+    if (n.is_map()) {
+      w.key(child.name());
+    } else {
+      w.item();
+    }
+    write_structure_json(w, child);
+  }
+  w.end(n.is_map() ? '}' : ']');
+}
+
+void Configuration::write_json(std::ostream &out, int indent) const {
+  JsonStreamWriter w{out, indent};
+  w.begin('{');
+  w.key("config");
+  write_config_json(w, structure.root(), *this);
+  w.key("structure");
+  write_structure_json(w, structure.root());
+  w.key("types");
+  if (types.empty()) {
+    w.value(nullptr);
+  } else {
+    w.begin('{');
+    for (const auto &[name, type] : types) {
+      w.key(name);
+      write_structure_json(w, type.root());
     }
+    w.end('}');
   }
+  w.end('}');
 }
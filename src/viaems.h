@@ -1,6 +1,7 @@
 #ifndef VIAEMS_PROTOCOL_H
 #define VIAEMS_PROTOCOL_H
 
+#include <array>
 #include <chrono>
 #include <cstdint>
 #include <deque>
@@ -9,7 +10,9 @@
 #include <map>
 #include <memory>
 #include <optional>
+#include <set>
 #include <sstream>
+#include <unordered_map>
 #include <variant>
 #include <vector>
 
@@ -17,6 +20,11 @@
 #include <nlohmann/json.hpp>
 using json = nlohmann::json;
 
+#include "Metrics.h"
+#include "Trace.h"
+
+class ConfigCache;
+
 namespace viaems {
 
 typedef std::chrono::time_point<std::chrono::system_clock> FeedTime;
@@ -24,14 +32,44 @@ typedef std::variant<uint32_t, float> FeedValue;
 
 typedef std::vector<std::variant<int, std::string>> StructurePath;
 
+/* Dense integer id of a path, from a PathInterner */
+typedef uint32_t PathId;
+static const PathId invalid_path_id = 0xffffffff;
+
+struct StructurePathHash {
+  size_t operator()(const StructurePath &path) const;
+};
+
+/* Assigns each distinct path the next id, in the order they are first seen */
+class PathInterner {
+  std::unordered_map<StructurePath, PathId, StructurePathHash> ids;
+  std::vector<StructurePath> paths;
+
+public:
+  PathId intern(const StructurePath &path);
+  std::optional<PathId> find(const StructurePath &path) const;
+  const StructurePath &path(PathId id) const { return paths[id]; }
+  size_t size() const { return paths.size(); }
+};
+
 struct LogPoint {
   std::chrono::system_clock::time_point time;
   std::vector<viaems::FeedValue> values;
 };
 
+/* A break in the feed where frames were expected but never arrived, such as
+ * from a serial overrun. lost_samples is 0 if the target restarted, as the
+ * number lost is then unknown */
+struct FeedGap {
+  std::chrono::system_clock::time_point start;
+  std::chrono::system_clock::time_point end;
+  uint32_t lost_samples;
+};
+
 struct LogChunk {
   std::vector<LogPoint> points;
   std::vector<std::string> keys;
+  std::vector<FeedGap> gaps;
 };
 
 struct TableAxis {
@@ -39,13 +77,37 @@ struct TableAxis {
   std::vector<float> labels;
 };
 
+/* Inclusive range of table cells */
+struct TableRegion {
+  int top;
+  int left;
+  int bottom;
+  int right;
+};
+
 struct TableValue {
   std::string title;
   std::vector<TableAxis> axis;
-  std::vector<float> one;
-  std::vector<std::vector<float>> two;
+
+  /* Cells in row-major order. A table with one axis is a single column, with
+   * a row per label */
+  int rows = 0;
+  int cols = 0;
+  std::vector<float> data;
+
+  float &at(int row, int col) { return data[row * cols + col]; }
+  float at(int row, int col) const { return data[row * cols + col]; }
 
   void resize(int R, int C);
+
+  /* Operations on all cells of a region, a row at a time */
+  void fill(TableRegion region, float value);
+  void offset(TableRegion region, float amount);
+  void scale(TableRegion region, float factor);
+  /* Each cell becomes the mean of itself and its neighbours */
+  void smooth(TableRegion region);
+  /* Cells inside the region are linearly interpolated from its edges */
+  void interpolate(TableRegion region);
 };
 
 struct SensorValue {
@@ -89,56 +151,255 @@ struct OutputValue {
   std::string type;
 };
 
+inline bool operator==(const TableAxis &a, const TableAxis &b) {
+  return (a.name == b.name) && (a.labels == b.labels);
+}
+
+inline bool operator==(const TableValue &a, const TableValue &b) {
+  return (a.title == b.title) && (a.axis == b.axis) && (a.rows == b.rows) &&
+         (a.cols == b.cols) && (a.data == b.data);
+}
+
+inline bool operator==(const SensorValue &a, const SensorValue &b) {
+  return (a.source == b.source) && (a.method == b.method) &&
+         (a.pin == b.pin) && (a.lag == b.lag) &&
+         (a.fault.max == b.fault.max) && (a.fault.min == b.fault.min) &&
+         (a.fault.value == b.fault.value) && (a.range_min == b.range_min) &&
+         (a.range_max == b.range_max) && (a.raw_min == b.raw_min) &&
+         (a.raw_max == b.raw_max) && (a.const_value == b.const_value) &&
+         (a.therm.a == b.therm.a) && (a.therm.b == b.therm.b) &&
+         (a.therm.c == b.therm.c) && (a.therm.bias == b.therm.bias) &&
+         (a.window.windows_per_cycle == b.window.windows_per_cycle) &&
+         (a.window.opening == b.window.opening) &&
+         (a.window.offset == b.window.offset);
+}
+
+inline bool operator==(const OutputValue &a, const OutputValue &b) {
+  return (a.angle == b.angle) && (a.inverted == b.inverted) &&
+         (a.pin == b.pin) && (a.type == b.type);
+}
+
 typedef std::variant<uint32_t, float, bool, std::string, TableValue,
                      SensorValue, OutputValue>
     ConfigValue;
 
+/* The json form of a value, as sent to the target and saved in configs */
+json json_from_value(const ConfigValue &value);
+ConfigValue value_from_json(const json &value);
+
+/* 64 bit FNV-1a of the bytes, as 16 hex digits. Identifies content such as
+ * a firmware build's structure or a saved config */
+std::string fnv1a_hex(const uint8_t *data, size_t len);
+
+/* Values keyed by path, stored flat and indexed by interned path id. Paths
+ * are interned in the order they are first stored, so ids are dense */
+class ConfigValues {
+  PathInterner interner;
+  std::vector<std::optional<ConfigValue>> values;
+  size_t count = 0;
+
+public:
+  class const_iterator {
+    const ConfigValues *owner;
+    PathId id;
+
+    void skip_empty() {
+      while ((id < owner->values.size()) && !owner->values[id]) {
+        id++;
+      }
+    }
+
+  public:
+    const_iterator(const ConfigValues *o, PathId i) : owner{o}, id{i} {
+      skip_empty();
+    }
+    std::pair<const StructurePath &, const ConfigValue &> operator*() const {
+      return {owner->interner.path(id), *owner->values[id]};
+    }
+    const_iterator &operator++() {
+      id++;
+      skip_empty();
+      return *this;
+    }
+    bool operator!=(const const_iterator &o) const { return id != o.id; }
+  };
+
+  const_iterator begin() const { return const_iterator{this, 0}; }
+  const_iterator end() const {
+    return const_iterator{this, (PathId)values.size()};
+  }
+
+  /* The id of path, assigning one if it has none */
+  PathId id(const StructurePath &path);
+  std::optional<PathId> find_id(const StructurePath &path) const {
+    return interner.find(path);
+  }
+  const StructurePath &path(PathId id) const { return interner.path(id); }
+
+  const ConfigValue *find(PathId id) const {
+    return ((id < values.size()) && values[id]) ? &*values[id] : nullptr;
+  }
+  const ConfigValue *find(const StructurePath &path) const;
+  ConfigValue *find_mutable(const StructurePath &path);
+
+  void insert_or_assign(PathId id, ConfigValue value);
+  void insert_or_assign(const StructurePath &path, ConfigValue value) {
+    insert_or_assign(id(path), std::move(value));
+  }
+
+  size_t size() const { return count; }
+  bool empty() const { return count == 0; }
+  void clear();
+
+  bool operator==(const ConfigValues &o) const;
+};
+
+/* Persistent map of values by path id. Copies share all of their storage,
+ * and assign copies only the chunk holding the id, so a snapshot per edit
+ * costs about as much as the edit */
+class ValueSnapshot {
+  static constexpr size_t chunk_size = 64;
+  typedef std::array<std::shared_ptr<const ConfigValue>, chunk_size> Chunk;
+  std::shared_ptr<const std::vector<std::shared_ptr<const Chunk>>> chunks;
+
+public:
+  const ConfigValue *find(PathId id) const;
+  /* A snapshot of these values with id set to value */
+  ValueSnapshot assign(PathId id, ConfigValue value) const;
+  /* Ids whose values differ from other, skipping chunks the two share */
+  std::vector<PathId> differences(const ValueSnapshot &other) const;
+};
+
 struct StructureLeaf {
   std::string description;
   std::string type;
   std::vector<std::string> choices;
   StructurePath path;
+
+  /* Id of path in the values of the Configuration holding the structure */
+  PathId id = invalid_path_id;
 };
 
-struct StructureNode {
-  using StructureMap = std::map<std::string, StructureNode>;
-  using StructureList = std::vector<StructureNode>;
-  using StructureType =
-      std::variant<StructureList, StructureMap, StructureLeaf>;
+/* Handle of a node in a StructureTree, stable for the life of the tree and
+ * across copies of it */
+typedef uint32_t NodeHandle;
+
+class StructureNode;
+
+/* The structure is held in one arena: the children of a node are a
+ * contiguous range of nodes, and leaves are stored in depth-first order */
+struct StructureTree {
+  enum class Kind : uint8_t { Map, List, Leaf };
+
+  struct Node {
+    Kind kind = Kind::Map;
+    std::string name; /* Key in the parent map, empty otherwise */
+    NodeHandle first_child = 0;
+    uint32_t child_count = 0;
+    uint32_t leaf = 0; /* Index into leaves for a Leaf */
+  };
+
+  /* Starts as an empty map */
+  StructureTree() : nodes(1) {}
+
+  std::vector<Node> nodes;
+  std::vector<StructureLeaf> leaves;
 
-  StructureType data;
+  StructureNode root() const;
+  StructureNode node(NodeHandle handle) const;
+};
+
+/* Cheap view of one node of a StructureTree. It is only valid while the tree
+ * it was taken from is alive */
+class StructureNode {
+public:
+  class iterator {
+  public:
+    iterator(const StructureTree *tree, NodeHandle handle)
+        : tree{tree}, handle{handle} {}
+    StructureNode operator*() const { return StructureNode{tree, handle}; }
+    iterator &operator++() {
+      handle++;
+      return *this;
+    }
+    bool operator!=(const iterator &other) const {
+      return handle != other.handle;
+    }
 
-  bool is_map() { return std::holds_alternative<StructureMap>(this->data); }
-  StructureMap map() { return std::get<StructureMap>(this->data); }
+  private:
+    const StructureTree *tree;
+    NodeHandle handle;
+  };
 
-  bool is_list() const {
-    return std::holds_alternative<StructureList>(this->data);
+  StructureNode(const StructureTree *tree, NodeHandle handle)
+      : tree{tree}, m_handle{handle} {}
+
+  NodeHandle handle() const { return m_handle; }
+  bool is_map() const { return node().kind == StructureTree::Kind::Map; }
+  bool is_list() const { return node().kind == StructureTree::Kind::List; }
+  bool is_leaf() const { return node().kind == StructureTree::Kind::Leaf; }
+
+  /* Key of this node in its parent map */
+  const std::string &name() const { return node().name; }
+  const StructureLeaf &leaf() const { return tree->leaves.at(node().leaf); }
+
+  size_t size() const { return node().child_count; }
+  StructureNode child(size_t i) const {
+    return StructureNode{tree, node().first_child + (NodeHandle)i};
   }
-  StructureList list() { return std::get<StructureList>(this->data); }
+  /* Child of a map by key */
+  std::optional<StructureNode> find(const std::string &name) const;
 
-  bool is_leaf() const {
-    return std::holds_alternative<StructureLeaf>(this->data);
+  iterator begin() const { return iterator{tree, node().first_child}; }
+  iterator end() const {
+    return iterator{tree, node().first_child + node().child_count};
   }
-  StructureLeaf leaf() { return std::get<StructureLeaf>(this->data); }
+
+private:
+  const StructureTree::Node &node() const { return tree->nodes[m_handle]; }
+
+  const StructureTree *tree;
+  NodeHandle m_handle;
 };
 
+inline StructureNode StructureTree::root() const { return node(0); }
+inline StructureNode StructureTree::node(NodeHandle handle) const {
+  return StructureNode{this, handle};
+}
+
 struct Configuration {
   std::chrono::system_clock::time_point save_time;
   std::string name;
-  StructureNode structure;
-  std::map<std::string, StructureNode> types;
-  std::map<StructurePath, ConfigValue> values;
+  StructureTree structure;
+  std::map<std::string, StructureTree> types;
+  ConfigValues values;
 
-  std::optional<ConfigValue> get(StructurePath path) const {
+  std::optional<ConfigValue> get(const StructurePath &path) const {
     auto val = values.find(path);
-    if (val == values.end()) {
+    if (val == nullptr) {
       return {};
     }
-    return val->second;
+    return *val;
   }
 
+  /* Lookup without copying, by path or by a leaf's id */
+  const ConfigValue *find(const StructurePath &path) const {
+    return values.find(path);
+  }
+  const ConfigValue *find(PathId id) const { return values.find(id); }
+
+  /* Give every leaf of the structure an id, in structure order. Done
+   * whenever the structure is replaced */
+  void index_structure();
+
   void from_json(const json &);
   json to_json() const;
+  /* Same text as to_json().dump(indent), without building the document */
+  void write_json(std::ostream &out, int indent = -1) const;
+
+  /* Hash of the structure and types, identifying the firmware build the
+   * configuration belongs to */
+  std::string fingerprint() const;
 };
 
 typedef void (*get_cb)(StructurePath path, ConfigValue val, void *ptr);
@@ -148,8 +409,8 @@ struct GetRequest {
   void *ptr;
 };
 
-typedef void (*structure_cb)(StructureNode top,
-                             std::map<std::string, StructureNode> types,
+typedef void (*structure_cb)(StructureTree top,
+                             std::map<std::string, StructureTree> types,
                              void *ptr);
 struct StructureRequest {
   structure_cb cb;
@@ -162,7 +423,9 @@ struct PingRequest {
   void *ptr;
 };
 
-typedef void (*set_cb)(StructurePath path, ConfigValue val, void *ptr);
+/* val is empty if the target answered with an error */
+typedef void (*set_cb)(StructurePath path, std::optional<ConfigValue> val,
+                       void *ptr);
 struct SetRequest {
   set_cb cb;
   StructurePath path;
@@ -173,6 +436,20 @@ struct SetRequest {
 struct FlashRequest {};
 struct BootloaderRequest {};
 
+/* Queued requests are sent highest priority first. Control is for keeping
+ * the connection alive, Interactive for anything a user is waiting on, and
+ * Background for bulk work such as interrogation */
+enum class RequestPriority {
+  Control = 0,
+  Interactive,
+  Background,
+  Count,
+};
+
+struct Request;
+/* Called once a request has gone unanswered through all of its retries */
+typedef void (*failed_cb)(std::shared_ptr<Request> req, void *ptr);
+
 struct Request {
   uint32_t id;
   std::variant<StructureRequest, GetRequest, SetRequest, PingRequest,
@@ -180,12 +457,25 @@ struct Request {
       request;
   bool is_sent;
   json repr;
+  RequestPriority priority = RequestPriority::Interactive;
+  std::chrono::steady_clock::time_point queued_time;
+  std::chrono::steady_clock::time_point sent_time;
+
+  /* Unanswered requests are resent after timeout, up to retries times */
+  std::chrono::milliseconds timeout{1000};
+  int retries = 3;
+  failed_cb failed = nullptr;
+  void *failed_ptr = nullptr;
 };
 
 class Connection {
 public:
+  /* Called, possibly from another thread, when a message may be available */
+  typedef void (*notify_cb)(void *ptr);
+
   virtual void Write(const json &msg) = 0;
   virtual std::optional<json> Read() = 0;
+  virtual ConnectionStats Stats() { return {}; }
   virtual ~Connection() {}
 };
 
@@ -196,43 +486,99 @@ public:
   LogChunk FeedUpdates();
   void NewData();
 
-  void SetTrace(int level) { this->trace = level; }
+  void SetTracer(std::shared_ptr<Tracer> t) { tracer = t; }
 
-  std::shared_ptr<Request> Get(get_cb, StructurePath path, void *);
-  std::shared_ptr<Request> Structure(structure_cb, void *);
+  std::shared_ptr<Request>
+  Get(get_cb, StructurePath path, void *,
+      RequestPriority priority = RequestPriority::Interactive);
+  std::shared_ptr<Request>
+  Structure(structure_cb, void *,
+            RequestPriority priority = RequestPriority::Interactive);
   std::shared_ptr<Request> Ping(ping_cb, void *);
-  std::shared_ptr<Request> Set(set_cb, StructurePath, ConfigValue, void *);
+  std::shared_ptr<Request>
+  Set(set_cb, StructurePath, ConfigValue, void *,
+      RequestPriority priority = RequestPriority::Interactive);
   void Flash();
   void Bootloader();
   bool Cancel(std::shared_ptr<Request> req);
 
+  /* Resend the outstanding request if it has timed out, or give up on it
+   * once its retries are used. Should be called regularly */
+  void Poll();
+
+  /* Snapshot of the metrics collected since connecting or the last reset */
+  ProtocolMetrics Metrics() const;
+  void ResetMetrics();
+
 private:
   std::unique_ptr<Connection> connection;
-  int trace = 0;
+  std::shared_ptr<Tracer> tracer;
+
+  ProtocolMetrics metrics;
+  std::chrono::steady_clock::time_point feed_window_start;
+  uint64_t feed_window_frames = 0;
 
   std::vector<std::string> m_feed_vars;
   LogChunk m_feed_updates;
   std::function<void(const json &)> write_cb;
-  std::deque<std::shared_ptr<Request>> m_requests;
+
+  /* Only one request is outstanding at a time, the rest wait by priority */
+  std::shared_ptr<Request> m_inflight;
+  std::array<std::deque<std::shared_ptr<Request>>,
+             (size_t)RequestPriority::Count>
+      m_queues;
+
+  /* Times each class has been passed over for a higher one while waiting.
+   * Once this reaches max_priority_skips the class is served next, so that
+   * a steady stream of interactive requests can't stall interrogation */
+  std::array<int, (size_t)RequestPriority::Count> m_skipped{};
+  static const int max_priority_skips = 8;
 
   std::chrono::system_clock::time_point zero_time;
   uint32_t last_feed_time = -1;
 
+  /* Expected cputime ticks between feed frames, learned from the feed */
+  double feed_interval = 0;
+  /* Run of consecutive gaps with similar deltas, and their mean delta */
+  int feed_gap_run = 0;
+  double feed_gap_interval = 0;
+  bool feed_started = false;
+  FeedTime last_feed_point;
+
   const int max_inflight_reqs = 1;
 
   void handle_feed_message_from_ems(const json &m);
   void handle_description_message_from_ems(const json &m);
   void handle_response_message_from_ems(const json &msg);
+  void enqueue(std::shared_ptr<Request> req);
+  size_t pending_requests() const;
+  std::shared_ptr<Request> next_request();
+  void send(std::shared_ptr<Request> req);
   void ensure_sent();
+  void count_feed_frame(std::chrono::steady_clock::time_point now);
+  void detect_feed_gap(uint32_t cputime, FeedTime time, bool rebased);
 };
 
+/* in_progress is set until every value has been read. When the values were
+ * instead taken from the config cache, in_progress is clear and revalidating
+ * is set while they are read back to check them. have_structure is set once
+ * the structure is known, before any values need have arrived */
 struct InterrogationState {
   bool in_progress;
   int total_nodes;
   int complete_nodes;
+  bool revalidating;
+  bool have_structure;
+};
+
+struct UploadState {
+  bool in_progress;
+  int total;
+  int complete;
 };
 
 typedef void (*interrogation_change_cb)(InterrogationState, void *ptr);
+typedef void (*upload_change_cb)(UploadState, void *ptr);
 typedef void (*value_change_cb)(StructurePath path, void *ptr);
 
 class Model {
@@ -248,27 +594,151 @@ class Model {
   interrogation_change_cb interrogate_cb = nullptr;
   void *interrogate_cb_ptr;
   std::shared_ptr<Request> structure_req;
-  std::vector<std::shared_ptr<Request>> get_reqs;
+  std::map<StructurePath, std::shared_ptr<Request>> get_reqs;
+  std::set<StructurePath> pending_paths;
+
+  std::shared_ptr<ConfigCache> cache;
+
+  /* Edits are held until they have settled for set_debounce, or for at most
+   * set_max_delay while they keep changing, and only the newest value of
+   * each path is sent */
+  struct DebouncedSet {
+    ConfigValue value;
+    std::chrono::steady_clock::time_point first_edit;
+    std::chrono::steady_clock::time_point last_edit;
+  };
+  std::map<StructurePath, DebouncedSet> debounced_sets;
+  std::map<StructurePath, std::shared_ptr<Request>> set_reqs;
+
+  /* Cleared once the target rejects a table element write */
+  bool element_writes = true;
+
+  /* With optimistic writes, edits are applied to config straight away. The
+   * journal holds the last confirmed value of each path with an unconfirmed
+   * edit, and a write the target answers differently, or never answers, is
+   * rolled back to what the target has */
+  bool optimistic = false;
+  std::map<StructurePath, std::optional<ConfigValue>> journal;
+  value_change_cb rollback_cb = nullptr;
+  void *rollback_cb_ptr;
+  value_change_cb confirmed_cb = nullptr;
+  void *confirmed_cb_ptr;
+
+  /* Upload members */
+  UploadState upload_state{};
+  upload_change_cb upload_cb = nullptr;
+  void *upload_cb_ptr;
+  std::set<StructurePath> upload_paths;
+
+  /* Undo history. history[i] holds the edited values as of the i-th edit,
+   * and edited_from the value of each edited path before its first edit.
+   * Paths are interned separately from config, which can be replaced */
+  PathInterner history_paths;
+  std::vector<ValueSnapshot> history{ValueSnapshot{}};
+  size_t history_pos = 0;
+  std::unordered_map<PathId, ConfigValue> edited_from;
+
+  static constexpr std::chrono::milliseconds set_debounce{100};
+  static constexpr std::chrono::milliseconds set_max_delay{250};
 
   static void handle_model_get(StructurePath path, ConfigValue val, void *ptr);
-  static void handle_model_set(StructurePath path, ConfigValue val, void *ptr);
-  static void handle_model_structure(StructureNode root,
-                                     std::map<std::string, StructureNode> types,
+  static void handle_model_set(StructurePath path,
+                               std::optional<ConfigValue> val, void *ptr);
+  static void handle_model_set_failed(std::shared_ptr<Request> req, void *ptr);
+  void merge_journalled_table(const StructurePath &path, TableValue fetched,
+                              const std::optional<ConfigValue> &known);
+  static void handle_model_structure(StructureTree root,
+                                     std::map<std::string, StructureTree> types,
                                      void *ptr);
+  void request_pending_values();
+  void cancel_pending_values();
+  void send_set(const StructurePath &path, const ConfigValue &value,
+                RequestPriority priority = RequestPriority::Interactive);
+  void finish_upload(const StructurePath &path);
+  std::optional<StructurePath>
+  element_table_path(const StructurePath &path) const;
+  bool has_pending_writes(const StructurePath &prefix) const;
+  void handle_rejected_element_write(const StructurePath &table_path,
+                                     const StructurePath &path,
+                                     std::shared_ptr<Request> sent);
+  std::optional<ConfigValue> current_value(const StructurePath &path);
+  void store_value(const StructurePath &path, const ConfigValue &val);
+  void journal_write(const StructurePath &path, const ConfigValue &value);
+  void confirm_write(const StructurePath &path, const ConfigValue &val);
+  void roll_back(const StructurePath &path, const ConfigValue &val);
+  void abandon_write(const StructurePath &path);
+  void report_confirmed(const StructurePath &path);
+  void write_value(const StructurePath &path, const ConfigValue &value);
+  void write_table_cells(const StructurePath &path, const TableValue &table,
+                         const std::set<std::pair<int, int>> &cells);
+  std::optional<ConfigValue> edited_value(const StructurePath &path);
+  void record_edit(const StructurePath &path, const ConfigValue &value);
+  void restore(const ValueSnapshot &from, const ValueSnapshot &to);
+  /* Edits can't be undone across a change of the whole configuration */
+  void clear_history();
 
 public:
   const Configuration &configuration() const { return config; };
   void set_configuration(const Configuration &c);
   void set_protocol(std::shared_ptr<Protocol>);
+  void set_cache(std::shared_ptr<ConfigCache> c) { cache = c; }
 
   void set_value_change_callback(value_change_cb cb, void *ptr) {
     value_cb = cb;
     value_cb_ptr = ptr;
   }
 
+  void set_rollback_callback(value_change_cb cb, void *ptr) {
+    rollback_cb = cb;
+    rollback_cb_ptr = ptr;
+  }
+  void set_optimistic(bool o) { optimistic = o; }
+
+  /* Called for every path once an interrogation or revalidation completes,
+   * and after for each value the target confirms or is rolled back to, but
+   * never for unconfirmed edits. See confirmed_value */
+  void set_confirmed_value_callback(value_change_cb cb, void *ptr) {
+    confirmed_cb = cb;
+    confirmed_cb_ptr = ptr;
+  }
+  /* Value of path as the target has it, which differs from configuration()
+   * while optimistic edits under it are unconfirmed */
+  std::optional<ConfigValue> confirmed_value(const StructurePath &path) const;
+  /* Whether any edit at or under prefix is waiting to be sent or confirmed */
+  bool has_unconfirmed_edits(const StructurePath &prefix) const;
+
   InterrogationState interrogation_status();
   void interrogate(interrogation_change_cb cb, void *ptr);
+
+  /* Continue a stalled interrogation, fetching only what is still missing.
+   * Starts a full interrogation if none is in progress */
+  void resume_interrogation(interrogation_change_cb cb, void *ptr);
+
+  /* Fetch any values still pending under prefix ahead of the rest of the
+   * interrogation, such as for the part of the config being viewed */
+  void prioritize(const StructurePath &prefix);
   void set_value(StructurePath path, ConfigValue value);
+
+  /* Write only the given (row, column) cells of the table at path, falling
+   * back to a whole table write when that is cheaper or the target doesn't
+   * support element writes */
+  void set_table_cells(const StructurePath &path, const TableValue &table,
+                       const std::set<std::pair<int, int>> &cells);
+
+  /* Write the values of conf that differ from the current configuration to
+   * the target, in the background. Call before replacing the configuration
+   * with set_configuration, as that is what is compared against */
+  void upload(const Configuration &conf, upload_change_cb cb, void *ptr);
+
+  /* Step through the edits made with set_value and set_table_cells. The
+   * restored values are written through the same path as an edit */
+  bool undo();
+  bool redo();
+  bool can_undo() const { return history_pos > 0; }
+  bool can_redo() const { return history_pos + 1 < history.size(); }
+
+  /* Send edits whose debounce has elapsed. Should be called regularly */
+  void poll();
 };
 
 } // namespace viaems